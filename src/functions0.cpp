@@ -4,6 +4,7 @@
 
 void test_fnc0()
 {
+    SYN_MEMORY_SCOPE("test_fnc0");
     // Syn::vector<int> vec0 = SYN_VECTOR(int); vec0.reserve(100);
     auto vec0 = SYN_VECTOR(int); vec0.reserve(100);
     // Syn::vector<int> vec1 = SYN_VECTOR(int); vec1.reserve(100);
@@ -4,6 +4,7 @@
 
 void test_fnc1()
 {
+	SYN_MEMORY_SCOPE("test_fnc1");
 	Syn::vector<double> vec0 = SYN_VECTOR(double); vec0.reserve(100);
 
 
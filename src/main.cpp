@@ -4,8 +4,11 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <thread>
 
 #include "syn_allocator.h"
+#include "syn_leak_scan.h"
+#include "syn_report_writer.h"
 #include "header.h"
 
 
@@ -33,10 +36,13 @@ public:
 
 int main()
 {
+    Syn::set_thread_name("main");
+
     Syn::vector<int> vec = SYN_VECTOR(int);
     std::cout << vec.size() << "\n";
     for (int i = 0; i < 20; i++)
 	vec.push_back(i);
+    Syn::record_size(vec);
     Syn::vector<double> vec1 = SYN_VECTOR(double); vec1.reserve(10);
 
     Syn::map<int, std::string> map0 = SYN_MAP(int, std::string);
@@ -61,11 +67,58 @@ int main()
     SYN_DELETE(pint);
     SYN_DELETE_N(pint2);
     SYN_DELETE(pint3);
+    testClass* ptest = SYN_NEW(testClass, 1, 2.0, "a string too long for the small string optimization");
+    std::string* pstr = SYN_NEW_N(std::string, 4);
+    pstr[3] = ptest->m_c;
+    SYN_DELETE(ptest);
+    SYN_DELETE_N(pstr);
     test_fnc0();
     test_fnc1();
 
+    // per-thread attribution: allocated by a worker, deallocated by main
+    std::vector<int*> handoff;
+    std::thread worker([&handoff]()
+    {
+	Syn::set_thread_name("io-worker-1");
+	for (int i = 0; i < 4; i++)
+	    handoff.push_back(SYN_NEW_N(int, 64));
+    });
+    worker.join();
+    for (auto p : handoff)
+	SYN_DELETE_N(p);
+
+    // memory budgets
+    memory_budget::set_soft_limit_callback([](AllocType, uint16_t _tag, uint64_t _used, uint64_t _limit)
+	{ std::cout << "soft limit of '" << memory_tag::name(_tag) << "' crossed: " << _used << " > " << _limit << " bytes.\n"; });
+    memory_budget::set_limit("budget_demo", 256 * 1024, 1024 * 1024);
+    {
+	SYN_MEMORY_SCOPE("budget_demo");
+	int* small = SYN_NEW_N(int, 128 * 1024);
+	try
+	{
+	    int* large = SYN_NEW_N(int, 1024 * 1024);
+	    SYN_DELETE_N(large);
+	}
+	catch (const std::bad_alloc&) { std::cout << "hard limit of 'budget_demo' exceeded.\n"; }
+	SYN_DELETE_N(small);
+    }
+
     memory_log::print_alloc_all(false, true);
     std::cout << "\n\n";
+    memory_log::print_slack_analysis(true, true);
+    std::cout << "\n\n";
+    s_STLMemRsrcHandler.print_growth(true);
+    std::cout << "\n\n";
+
+    // leak classification: the containers above are reachable, the array dropped
+    // by the (exited) thread is not
+    std::thread([]() { int* leaked = SYN_NEW_N(int, 32); leaked[0] = 1; }).join();
+    std::cout << leak_scan::print(leak_scan::scan(), true);
+    std::cout << "\n\n";
+
+    // machine-readable export of the live records (to stdout)
+    std::cout << std::flush;
+    csv_writer().write(1);
 
 }
 
@@ -3,6 +3,15 @@
 
 #include <iomanip> 		// std::setw(), std::right and std::hex.
 #include <algorithm> 	// std::sort() and std::reverse().
+#include <fstream>
+#include <chrono>
+#include <tuple>
+
+#ifdef __linux__
+#include <unistd.h>		// sysconf(), getpid()
+#include <pthread.h>		// pthread_atfork()
+#include <sys/syscall.h>	// SYS_gettid
+#endif
 
 
 namespace Syn {
@@ -20,8 +29,60 @@ namespace Syn {
 	
     memory_usage memory_log::s_usageType[4];
     memory_usage memory_log::s_usageTotal = memory_usage();
+    std::vector<memory_usage> memory_log::s_usageTag;
+    std::vector<memory_usage> memory_log::s_usageThread;
+    std::vector<uint32_t> memory_log::s_remoteDeallocs;
+    std::unordered_map<std::string, uint32_t> memory_log::s_siteIds;
+    std::vector<std::string> memory_log::s_siteNames;
+    std::vector<memory_log::site_counts> memory_log::s_siteCounts;
+    std::unordered_map<uint32_t, std::map<std::pair<uint16_t, uint16_t>, memory_log::thread_pair_count>> memory_log::s_threadMatrix;
+    memory_usage memory_log::s_usageInherited;
     std::string memory_log::s_sz;
     std::string memory_log::s_lastLogEntry;
+    std::mutex memory_log::s_mutex;
+    int memory_log::s_atforkRegistered = memory_log::_register_atfork();
+    FILE* memory_log::s_trace = nullptr;
+    std::string memory_log::s_tracePath;
+    std::vector<bool> memory_log::s_traceSites;
+
+    thread_local uint16_t memory_tag::s_stack[memory_tag::MAX_DEPTH];
+    thread_local uint16_t memory_tag::s_depth = 0;
+
+    // tag registry, function-local to be usable from static initializers
+    static std::mutex& tag_mutex() { static std::mutex m; return m; }
+    static std::unordered_map<std::string, uint16_t>& tag_ids() { static std::unordered_map<std::string, uint16_t> m; return m; }
+    static std::vector<std::string>& tag_names() { static std::vector<std::string> v = { "" }; return v; }
+
+    thread_local uint16_t memory_thread::s_id = 0;
+
+    // thread registry
+    static std::mutex& thread_mutex() { static std::mutex m; return m; }
+    static std::vector<std::string>& thread_names() { static std::vector<std::string> v = { "" }; return v; }
+    // stack [begin, end) per thread id, { 0, 0 } for the main thread and exited threads
+    static std::vector<std::pair<uintptr_t, uintptr_t>>& thread_stacks() { static std::vector<std::pair<uintptr_t, uintptr_t>> v = { { 0, 0 } }; return v; }
+
+    // ids of exited threads, reused once all ids have been handed out
+    static std::vector<uint16_t>& thread_free_ids() { static std::vector<uint16_t> v; return v; }
+    // shared by the threads registered while no id is free
+    static const uint16_t thread_overflow = UINT16_MAX - 1;
+
+    // clears the stack bounds of a registered thread and frees its id when it exits
+    struct thread_exit
+    {
+	uint16_t m_thread = 0;
+	~thread_exit()
+	{
+	    if (m_thread == 0)
+		return;
+	    std::lock_guard<std::mutex> lock(thread_mutex());
+	    if (m_thread < thread_stacks().size())
+		thread_stacks()[m_thread] = { 0, 0 };
+	    thread_free_ids().push_back(m_thread);
+	}
+    };
+    static thread_local thread_exit s_threadExit;
+
+    std::atomic<bool> memory_budget::s_enabled(false);
 	
 
     // initialization of global objects
@@ -37,26 +98,135 @@ namespace Syn {
 			    uint32_t _alloc_bytes, 
 			    uint32_t _alloc_block, 
 			    AllocType _alloc_type,
-			    const std::string& _caller_fnc) 
+			    const std::string& _caller_fnc,
+			    uint32_t _alignment) 
     { 
-	s_memory[_mem_addr] = memory_alloc_info(_alloc_bytes, _alloc_block, 0, 0, _alloc_type, _caller_fnc);
+	uint16_t tag = memory_tag::current();
+	uint16_t thread = memory_thread::current();
+	std::lock_guard<std::mutex> lock(s_mutex);
+	memory_alloc_info& info = s_memory[_mem_addr];
+	info = memory_alloc_info(_alloc_bytes, _alloc_block, 0, 0, _alloc_type, _caller_fnc, tag);
+	info.m_budgeted = memory_budget::enabled();
+	info.m_allocThread = thread;
+	info.m_alignment = _alignment;
+	auto site = s_siteIds.find(_caller_fnc);
+	if (site == s_siteIds.end())
+	{
+	    site = s_siteIds.insert({ _caller_fnc, (uint32_t)s_siteNames.size() }).first;
+	    s_siteNames.push_back(_caller_fnc);
+	    s_siteCounts.emplace_back();
+	}
+	info.m_site = site->second;
+	site_count& count = s_siteCounts[info.m_site].m_own[(int)_alloc_type];
+	count.m_allocs++;
+	count.m_allocBytes += _alloc_bytes;
+	count.m_allocBlock += _alloc_block;
 	// update memory usage
 	s_usageType[(int)_alloc_type].update_alloc(_alloc_bytes, _alloc_block);
 	s_usageTotal.update_alloc(_alloc_bytes, _alloc_block);
+	if (tag >= s_usageTag.size())
+	    s_usageTag.resize(tag + 1);
+	s_usageTag[tag].update_alloc(_alloc_bytes, _alloc_block);
+	if (thread >= s_usageThread.size())
+	{
+	    s_usageThread.resize(thread + 1);
+	    s_remoteDeallocs.resize(thread + 1);
+	}
+	s_usageThread[thread].update_alloc(_alloc_bytes, _alloc_block);
+	if (s_trace != nullptr)
+	{
+	    // call sites are defined on first use
+	    if (info.m_site >= s_traceSites.size())
+		s_traceSites.resize(info.m_site + 1, false);
+	    if (!s_traceSites[info.m_site])
+	    {
+		s_traceSites[info.m_site] = true;
+		fprintf(s_trace, "s %u %s\n", info.m_site, _caller_fnc.c_str());
+	    }
+	    fprintf(s_trace, "a %u %p %u %u\n", (unsigned)thread, _mem_addr, _alloc_bytes, info.m_site);
+	}
     }
 	
 
     //-----------------------------------------------------------------------------------
     void memory_log::remove(void* _mem_addr, uint32_t _dealloc_bytes, uint32_t _dealloc_block, AllocType _alloc_type)
     {
+	memory_thread::current();
+	std::unique_lock<std::mutex> lock(s_mutex);
 	auto iterator = s_memory.find(_mem_addr);
 	SYN_ASSERT(iterator != s_memory.end());
-	SYN_ASSERT(iterator->second.m_allocType == _alloc_type);
-	iterator->second.m_deallocBytes = _dealloc_bytes;
-	iterator->second.m_deallocBlock = _dealloc_block;
-	// update memory usage
+	memory_alloc_info& info = iterator->second;
+	_remove(info, _dealloc_bytes, _dealloc_block, _alloc_type);
+	if (s_trace != nullptr)
+	    fprintf(s_trace, "f %u %p\n", (unsigned)info.m_deallocThread, _mem_addr);
+	bool budgeted = info.m_budgeted;
+	uint16_t tag = info.m_tag;
+	uint32_t bytes = info.m_allocBytes;
+	lock.unlock();
+	// (the soft limit callback may allocate, so never under the record lock)
+	if (budgeted)
+	    memory_budget::credit(_alloc_type, tag, bytes);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    uint32_t memory_log::release(void* _mem_addr, AllocType _alloc_type, uint32_t* _alignment)
+    {
+	memory_thread::current();
+	std::unique_lock<std::mutex> lock(s_mutex);
+	auto iterator = s_memory.find(_mem_addr);
+	SYN_ASSERT(iterator != s_memory.end());
+	memory_alloc_info& info = iterator->second;
+	_remove(info, info.m_allocBytes, info.m_allocBlock, _alloc_type);
+	if (s_trace != nullptr)
+	    fprintf(s_trace, "f %u %p\n", (unsigned)info.m_deallocThread, _mem_addr);
+	bool budgeted = info.m_budgeted;
+	uint16_t tag = info.m_tag;
+	uint32_t bytes = info.m_allocBytes;
+	if (_alignment != nullptr)
+	    *_alignment = info.m_alignment;
+	lock.unlock();
+	// (the soft limit callback may allocate, so never under the record lock)
+	if (budgeted)
+	    memory_budget::credit(_alloc_type, tag, bytes);
+	return bytes;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_log::_remove(memory_alloc_info& _info, uint32_t _dealloc_bytes, uint32_t _dealloc_block, AllocType _alloc_type)
+    {
+	SYN_ASSERT(_info.m_allocType == _alloc_type);
+	_info.m_deallocBytes = _dealloc_bytes;
+	_info.m_deallocBlock = _dealloc_block;
+	// (the thread id is registered by the callers, outside the lock)
+	_info.m_deallocThread = memory_thread::current();
+	// allocations of the parent process are only accounted as inherited
+	if (_info.m_inherited)
+	{
+	    s_usageInherited.update_dealloc(_dealloc_bytes, _dealloc_block);
+	    s_siteCounts[_info.m_site].m_inherited[(int)_alloc_type].m_frees++;
+	    return;
+	}
+	s_siteCounts[_info.m_site].m_own[(int)_alloc_type].m_frees++;
+	// update memory usage; credit the tag the allocation was charged to, 
+	// regardless of the tags of the freeing thread
 	s_usageType[(int)_alloc_type].update_dealloc(_dealloc_bytes, _dealloc_block);
 	s_usageTotal.update_dealloc(_dealloc_bytes, _dealloc_block);
+	s_usageTag[_info.m_tag].update_dealloc(_dealloc_bytes, _dealloc_block);
+	s_usageThread[_info.m_allocThread].update_dealloc(_dealloc_bytes, _dealloc_block);
+	if (_info.m_deallocThread != _info.m_allocThread)
+	{
+	    thread_pair_count& pair = s_threadMatrix[_info.m_site][{ _info.m_allocThread, _info.m_deallocThread }];
+	    pair.m_count++;
+	    pair.m_bytes += _dealloc_bytes;
+	    if (_info.m_deallocThread >= s_remoteDeallocs.size())
+	    {
+		s_usageThread.resize(_info.m_deallocThread + 1);
+		s_remoteDeallocs.resize(_info.m_deallocThread + 1);
+	    }
+	    s_remoteDeallocs[_info.m_deallocThread]++;
+	}
     }
 
 
@@ -66,11 +236,33 @@ namespace Syn {
 	std::string exp = "MEMORY USAGE REPORT\n";
 	for (auto i : {AllocType::STL, AllocType::SHARED, AllocType::EXPLICIT} )
 	    exp += print_alloc_type(i, _omit_deallocated);
+	exp += print_alloc_tags();
+	exp += print_alloc_threads();
+
+	memory_usage inherited;
+	{
+	    std::lock_guard<std::mutex> lock(s_mutex);
+	    inherited = s_usageInherited;
+	}
+	if (inherited.m_allocCount > 0)
+	{
+	    std::ostringstream ss;
+	    ss << "INHERITED (allocated before fork)\n";
+	    ss << "Allocated:   " << std::right << std::setw(12) << _fmt_sz(inherited.m_physicalAlloc) << std::right << std::setw(14) << " (" + _fmt_sz(inherited.m_virtualAlloc) + ")" << "\n";
+	    ss << "Deallocated: " << std::right << std::setw(12) << _fmt_sz(inherited.m_physicalDealloc) << std::right << std::setw(14) << " (" + _fmt_sz(inherited.m_virtualDealloc) + ")" << "\n";
+	    ss << "Difference:  " << std::right << std::setw(12) << _fmt_sz(inherited.m_physicalAlloc - inherited.m_physicalDealloc) << std::right << std::setw(14) << 
+		" (" + _fmt_sz(inherited.m_virtualAlloc - inherited.m_virtualDealloc) + ")" <<  "\n\n";
+	    exp += ss.str();
+	}
 
 	// TODO: add 'overhead' of the memory_log class, the STLMemoryResourceHandler class
 	// and the MemoryResourceShared instance to the total memory footprint of the program,
 	// as a separate entry below.
-	memory_usage total = get_usage_total();
+	memory_usage total;
+	{
+	    std::lock_guard<std::mutex> lock(s_mutex);
+	    total = get_usage_total();
+	}
 	std::ostringstream ss;
 	ss << "TOTAL MEMORY USAGE\n";
 	ss << "Allocated:   " << std::right << std::setw(12) << _fmt_sz(total.m_physicalAlloc) << std::right << std::setw(14) << " (" + _fmt_sz(total.m_virtualAlloc) + ")" << "\n";
@@ -94,12 +286,13 @@ namespace Syn {
 	 * memory, all memory allocations of type _alloc_type must be 
 	 * obtained in a first run, and stored in a vector and sorted.
 	 */
+	std::lock_guard<std::mutex> lock(s_mutex);
 	std::vector<void*> vec_mem;
 	vec_mem.reserve(s_memory.size());
 	for (auto& it : s_memory)
 	{
-	    // only store of type _alloc_type
-	    if (it.second.m_allocType == _alloc_type)
+	    // only store of type _alloc_type, allocated by this process
+	    if (it.second.m_allocType == _alloc_type && !it.second.m_inherited)
 	    {
 		// store the memory address (i.e. the key in s_memory)
 		vec_mem.push_back(it.first);
@@ -114,9 +307,7 @@ namespace Syn {
 	for (auto& key : vec_mem)
 	{
 	    auto map_entry = s_memory[key];
-	    if ((_omit_deallocated) && 
-		(map_entry.m_allocBytes == map_entry.m_deallocBytes) && 
-		(map_entry.m_allocBlock == map_entry.m_deallocBlock))
+	    if (_omit_deallocated && map_entry.is_deallocated())
 		continue;
 	    else
 	    {
@@ -159,15 +350,950 @@ namespace Syn {
     }
 
 
+    //-----------------------------------------------------------------------------------
+    std::string memory_log::print_alloc_tags()
+    {
+	std::vector<memory_usage> usage;
+	{
+	    std::lock_guard<std::mutex> lock(s_mutex);
+	    usage = s_usageTag;
+	}
+	// nothing to report unless something was charged to a tag
+	if (usage.size() <= 1)
+	    return "";
+
+	std::ostringstream ss;
+	ss << std::setw(24) << std::left << "MEMORY TAG";
+	ss << std::setw(14) << std::right << "LIVE";
+	ss << std::setw(14) << std::right << "PEAK";
+	ss << std::setw(14) << std::right << "TOTAL";
+	ss << std::setw(10) << std::right << "ALLOCS";
+	ss << std::setw(10) << std::right << "FREES" << "\n";
+	for (uint16_t tag = 0; tag < usage.size(); tag++)
+	{
+	    const memory_usage& u = usage[tag];
+	    if (u.m_allocCount == 0)
+		continue;
+	    ss << std::setw(4) << "";
+	    ss << std::setw(20) << std::left << (tag == 0 ? "(untagged)" : memory_tag::name(tag));
+	    ss << std::setw(14) << std::right << _fmt_sz(u.m_physicalAlloc - u.m_physicalDealloc);
+	    ss << std::setw(14) << std::right << _fmt_sz(u.m_physicalPeak);
+	    ss << std::setw(14) << std::right << _fmt_sz(u.m_physicalAlloc);
+	    ss << std::setw(10) << std::right << u.m_allocCount;
+	    ss << std::setw(10) << std::right << u.m_deallocCount << "\n";
+	}
+	ss << "\n";
+	return ss.str();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string memory_log::print_alloc_threads()
+    {
+	std::vector<memory_usage> usage;
+	std::vector<uint32_t> remote;
+	std::vector<std::pair<std::string, std::vector<std::pair<std::pair<uint16_t, uint16_t>, thread_pair_count>>>> sites;
+	{
+	    std::lock_guard<std::mutex> lock(s_mutex);
+	    usage = s_usageThread;
+	    remote = s_remoteDeallocs;
+	    // (only cross-thread deallocations are recorded)
+	    for (auto& site : s_threadMatrix)
+		sites.push_back({ s_siteNames[site.first], { site.second.begin(), site.second.end() } });
+	}
+	// nothing to report for a single thread
+	if (usage.size() <= 2)
+	    return "";
+
+	std::ostringstream ss;
+	ss << std::setw(24) << std::left << "THREAD";
+	ss << std::setw(14) << std::right << "LIVE";
+	ss << std::setw(14) << std::right << "PEAK";
+	ss << std::setw(14) << std::right << "TOTAL";
+	ss << std::setw(10) << std::right << "ALLOCS";
+	ss << std::setw(10) << std::right << "FREES";
+	ss << std::setw(14) << std::right << "REMOTE FREES" << "\n";
+	for (uint16_t thread = 1; thread < usage.size(); thread++)
+	{
+	    const memory_usage& u = usage[thread];
+	    ss << std::setw(4) << "";
+	    ss << std::setw(20) << std::left << memory_thread::name(thread);
+	    ss << std::setw(14) << std::right << _fmt_sz(u.m_physicalAlloc - u.m_physicalDealloc);
+	    ss << std::setw(14) << std::right << _fmt_sz(u.m_physicalPeak);
+	    ss << std::setw(14) << std::right << _fmt_sz(u.m_physicalAlloc);
+	    ss << std::setw(10) << std::right << u.m_allocCount;
+	    ss << std::setw(10) << std::right << u.m_deallocCount;
+	    ss << std::setw(14) << std::right << remote[thread] << "\n";
+	}
+	ss << "\n";
+
+	if (!sites.empty())
+	{
+	    std::sort(sites.begin(), sites.end(), [](const decltype(sites)::value_type& _a, const decltype(sites)::value_type& _b) { return _a.first < _b.first; });
+	    ss << "CROSS-THREAD DEALLOCATION\n";
+	    for (auto& site : sites)
+	    {
+		ss << std::setw(4) << "" << site.first << "\n";
+		ss << std::setw(8) << "";
+		ss << std::setw(24) << std::left << "ALLOCATED BY";
+		ss << std::setw(24) << std::left << "DEALLOCATED BY";
+		ss << std::setw(10) << std::right << "COUNT";
+		ss << std::setw(14) << std::right << "BYTES" << "\n";
+		for (auto& pair : site.second)
+		{
+		    ss << std::setw(8) << "";
+		    ss << std::setw(24) << std::left << memory_thread::name(pair.first.first);
+		    ss << std::setw(24) << std::left << memory_thread::name(pair.first.second);
+		    ss << std::setw(10) << std::right << pair.second.m_count;
+		    ss << std::setw(14) << std::right << _fmt_sz(pair.second.m_bytes) << "\n";
+		}
+	    }
+	    ss << "\n";
+	}
+	return ss.str();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    memory_usage memory_log::get_usage_thread(uint16_t _thread)
+    {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return _thread < s_usageThread.size() ? s_usageThread[_thread] : memory_usage();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    memory_usage memory_log::get_usage_tag(uint16_t _tag)
+    {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return _tag < s_usageTag.size() ? s_usageTag[_tag] : memory_usage();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string memory_log::print_slack_analysis(bool _omit_deallocated, bool _use_std_out)
+    {
+	/* Aggregate all records per call site: requested and block bytes, and a
+	 * histogram of request sizes to find the dominant request of the site.
+	 */
+	struct site_slack
+	{
+	    std::string m_callerFnc;
+	    AllocType m_allocType = AllocType::NONE;
+	    uint32_t m_count = 0;
+	    uint64_t m_allocBytes = 0;
+	    uint64_t m_allocBlock = 0;
+	    std::map<uint32_t, uint32_t> m_sizes;
+	    uint64_t wasted() const { return m_allocBlock - m_allocBytes; }
+	};
+
+	std::unordered_map<std::string, site_slack> sites;
+	uint64_t live_bytes = 0;
+	uint64_t live_block = 0;
+	std::unique_lock<std::mutex> lock(s_mutex);
+	for (auto& it : s_memory)
+	{
+	    const memory_alloc_info& info = it.second;
+	    if (!info.is_deallocated())
+	    {
+		live_bytes += info.m_allocBytes;
+		live_block += info.m_allocBlock;
+	    }
+	    else if (_omit_deallocated)
+		continue;
+
+	    site_slack& site = sites[info.m_callerFnc];
+	    site.m_callerFnc = info.m_callerFnc;
+	    site.m_allocType = info.m_allocType;
+	    site.m_count++;
+	    site.m_allocBytes += info.m_allocBytes;
+	    site.m_allocBlock += info.m_allocBlock;
+	    site.m_sizes[info.m_allocBytes]++;
+	}
+	lock.unlock();
+
+	std::vector<const site_slack*> ranked;
+	ranked.reserve(sites.size());
+	for (auto& it : sites)
+	    ranked.push_back(&it.second);
+	std::sort(ranked.begin(), ranked.end(), 
+		  [](const site_slack* _a, const site_slack* _b) { return _a->wasted() > _b->wasted(); });
+
+	std::ostringstream ss;
+	ss << "SLACK ANALYSIS (" << (_omit_deallocated ? "live allocations" : "all allocations") << ")\n";
+	ss << std::setw(4) << "";
+	ss << std::setw(73) << std::right << "CALLING FUNCTION";
+	ss << std::setw(8) << std::right << "COUNT";
+	ss << std::setw(12) << std::right << "WASTED";
+	ss << std::setw(8) << std::right << "WASTE%";
+	ss << std::setw(12) << std::right << "REQUEST";
+	ss << std::setw(26) << std::right << "SIZE CLASS";
+	ss << std::setw(30) << std::right << "SUGGESTED REQUEST" << "\n";
+	for (auto site : ranked)
+	{
+	    // dominant (most frequent) request size of this call site
+	    auto dominant = std::max_element(site->m_sizes.begin(), site->m_sizes.end(),
+					     [](const std::pair<const uint32_t, uint32_t>& _a,
+						const std::pair<const uint32_t, uint32_t>& _b) { return _a.second < _b.second; });
+	    uint32_t request = dominant->first;
+	    malloc_size_class sc = get_malloc_size_class(request);
+
+	    std::ostringstream cls;
+	    cls << sc.m_bin;
+	    if (!strcmp(sc.m_bin, "tcache")) cls << "[" << sc.m_binIndex << "]";
+	    cls << " chunk " << sc.m_chunk;
+
+	    std::ostringstream sug;
+	    if (sc.m_usable == request)
+		sug << "(no slack)";
+	    else
+	    {
+		sug << sc.m_usable << " B";
+		if (sc.m_prevUsable > 0)
+		    sug << " or <= " << sc.m_prevUsable << " B";
+	    }
+
+	    float pct = site->m_allocBlock > 0 ? 100.0f * (float)site->wasted() / (float)site->m_allocBlock : 0.0f;
+	    ss << std::setw(4) << "";
+	    ss << std::right << std::setw(73) << site->m_callerFnc + (site->m_callerFnc == "" ? "(no caller function specified)" : "");
+	    ss << std::right << std::setw(8) << site->m_count;
+	    ss << std::right << std::setw(12) << _fmt_sz(site->wasted());
+	    ss << std::right << std::setw(7) << std::fixed << std::setprecision(1) << pct << "%";
+	    ss << std::right << std::setw(12) << _fmt_sz(request);
+	    ss << std::right << std::setw(26) << cls.str();
+	    ss << std::right << std::setw(30) << sug.str() << "\n";
+	}
+	ss << "Requested:   " << std::right << std::setw(12) << _fmt_sz(live_bytes) << "  (live, tracked)\n";
+	ss << "Slack:       " << std::right << std::setw(12) << _fmt_sz(live_block - live_bytes) << "  (live, tracked)\n\n";
+
+#ifdef __linux__
+	/* Process-level context: how much of the heap is tracked live data, slack,
+	 * untracked allocations or free memory retained by the allocator.
+	 */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+#else
+	struct mallinfo mi = mallinfo();
+#endif
+	// number of arenas, from the <heap nr=...> elements of malloc_info()
+	uint32_t arenas = 0;
+	char* xml = nullptr;
+	size_t xml_size = 0;
+	FILE* fp = open_memstream(&xml, &xml_size);
+	if (fp != nullptr)
+	{
+	    malloc_info(0, fp);
+	    fclose(fp);
+	    for (const char* p = xml; (p = strstr(p, "<heap nr=")) != nullptr; p++)
+		arenas++;
+	    free(xml);
+	}
+	uint64_t rss = 0;
+	std::ifstream statm("/proc/self/statm");
+	uint64_t vm_pages = 0, rss_pages = 0;
+	if (statm >> vm_pages >> rss_pages)
+	    rss = rss_pages * (uint64_t)sysconf(_SC_PAGESIZE);
+
+	uint64_t in_use = (uint64_t)mi.uordblks + (uint64_t)mi.hblkhd;
+	uint64_t untracked = in_use > live_block ? in_use - live_block : 0;
+	ss << "MALLOC STATISTICS\n";
+	ss << "Arenas:            " << std::right << std::setw(12) << arenas << "\n";
+	ss << "Free chunks:       " << std::right << std::setw(12) << mi.ordblks << "\n";
+	ss << "Mmapped chunks:    " << std::right << std::setw(12) << mi.hblks << "\n";
+	ss << "RSS:               " << std::right << std::setw(12) << _fmt_sz(rss) << "\n";
+	ss << "Heap (sbrk):       " << std::right << std::setw(12) << _fmt_sz(mi.arena) << "\n";
+	ss << "  in use:          " << std::right << std::setw(12) << _fmt_sz(in_use) << "  (incl. mmapped)\n";
+	ss << "    live data:     " << std::right << std::setw(12) << _fmt_sz(live_bytes) << "  (tracked)\n";
+	ss << "    slack:         " << std::right << std::setw(12) << _fmt_sz(live_block - live_bytes) << "  (tracked)\n";
+	ss << "    untracked:     " << std::right << std::setw(12) << _fmt_sz(untracked) << "\n";
+	ss << "  free:            " << std::right << std::setw(12) << _fmt_sz(mi.fordblks) << "  (fragmentation)\n";
+	ss << "    top pad:       " << std::right << std::setw(12) << _fmt_sz(mi.keepcost) << "  (releasable by malloc_trim)\n";
+#endif
+	std::string exp = ss.str();
+	if (_use_std_out)
+	    std::cout << exp;
+
+	return exp;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    malloc_size_class get_malloc_size_class(uint32_t _bytes)
+    {
+	/* Mirrors glibc request2size(): a chunk carries one size_t of header,
+	 * is aligned to 2*sizeof(size_t) and is at least 4*sizeof(size_t).
+	 * Requests above the (default) mmap threshold are page-rounded and 
+	 * carry two size_t:s of overhead.
+	 */
+	static constexpr uint32_t size_sz   = sizeof(size_t);
+	static constexpr uint32_t align     = 2 * size_sz;
+	static constexpr uint32_t min_chunk = 4 * size_sz;
+	// chunk of the last of the 64 tcache bins (usable 1032 on 64-bit)
+	static constexpr uint32_t tcache_max_chunk = 64 * align + min_chunk - align;	// 1040 on 64-bit
+	static constexpr uint32_t mmap_threshold   = 128 * 1024;
+
+	malloc_size_class sc;
+	sc.m_binIndex = 0;
+	if (_bytes >= mmap_threshold)
+	{
+	    uint32_t page = 4096;
+#ifdef __linux__
+	    page = (uint32_t)sysconf(_SC_PAGESIZE);
+#endif
+	    sc.m_chunk = (_bytes + 2 * size_sz + page - 1) & ~(page - 1);
+	    sc.m_usable = sc.m_chunk - 2 * size_sz;
+	    sc.m_prevUsable = sc.m_usable - page;
+	    sc.m_bin = "mmap";
+	    return sc;
+	}
+
+	uint32_t chunk = (_bytes + size_sz + align - 1) & ~(align - 1);
+	sc.m_chunk = chunk < min_chunk ? min_chunk : chunk;
+	sc.m_usable = sc.m_chunk - size_sz;
+	sc.m_prevUsable = sc.m_chunk > min_chunk ? sc.m_usable - align : 0;
+	if (sc.m_chunk <= tcache_max_chunk)
+	{
+	    sc.m_bin = "tcache";
+	    sc.m_binIndex = (sc.m_chunk - min_chunk) / align;
+	}
+	else
+	    sc.m_bin = "large";
+	return sc;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    bool memory_log::write_report(const std::string& _prefix, bool _omit_deallocated)
+    {
+#ifdef __linux__
+	long pid = (long)getpid();
+#elif defined(_WIN32)
+	long pid = (long)GetCurrentProcessId();
+#endif
+	std::string path = _prefix + "." + std::to_string(pid);
+	std::ofstream txt(path + ".txt");
+	std::ofstream tsv(path + ".tsv");
+	if (!txt || !tsv)
+	{
+	    SYN_CORE_WARNING("memory_log: could not write report '" << path << "'.");
+	    return false;
+	}
+	txt << print_alloc_all(_omit_deallocated, false);
+
+	/* Per call site profile, one row per (AllocType, caller, inherited), so 
+	 * that a merge of several workers can count inherited allocations once.
+	 * The counts are the call site counters, the live sizes those of the
+	 * live records (which are never overwritten).
+	 */
+	struct site_profile
+	{
+	    uint64_t m_allocs = 0, m_frees = 0;
+	    uint64_t m_allocBytes = 0, m_allocBlock = 0;
+	    uint64_t m_liveBytes = 0, m_liveBlock = 0;
+	};
+	std::map<std::tuple<int, std::string, bool>, site_profile> sites;
+	{
+	    std::lock_guard<std::mutex> lock(s_mutex);
+	    for (uint32_t id = 0; id < s_siteCounts.size(); id++)
+		for (int type = 0; type < 4; type++)
+		    for (bool inherited : { false, true })
+		    {
+			const site_count& count = inherited ? s_siteCounts[id].m_inherited[type] : s_siteCounts[id].m_own[type];
+			if (count.m_allocs == 0 && count.m_frees == 0)
+			    continue;
+			site_profile& site = sites[std::make_tuple(type, s_siteNames[id], inherited)];
+			site.m_allocs = count.m_allocs;
+			site.m_frees = count.m_frees;
+			site.m_allocBytes = count.m_allocBytes;
+			site.m_allocBlock = count.m_allocBlock;
+		    }
+	    for (auto& it : s_memory)
+	    {
+		const memory_alloc_info& info = it.second;
+		if (info.is_deallocated())
+		    continue;
+		site_profile& site = sites[std::make_tuple((int)info.m_allocType, info.m_callerFnc, info.m_inherited)];
+		site.m_liveBytes += info.m_allocBytes;
+		site.m_liveBlock += info.m_allocBlock;
+	    }
+	}
+	tsv << "# pid=" << pid << "\n";
+	tsv << "# type\tcaller\tinherited\tallocs\tfrees\talloc_bytes\talloc_block\tlive_bytes\tlive_block\n";
+	for (auto& it : sites)
+	{
+	    const site_profile& site = it.second;
+	    tsv << AllocTypeStr((AllocType)std::get<0>(it.first)) << '\t' << std::get<1>(it.first) << '\t' << std::get<2>(it.first) << '\t';
+	    tsv << site.m_allocs << '\t' << site.m_frees << '\t' << site.m_allocBytes << '\t' << site.m_allocBlock << '\t';
+	    tsv << site.m_liveBytes << '\t' << site.m_liveBlock << '\n';
+	}
+	return true;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    bool memory_log::start_trace(const std::string& _path)
+    {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (s_trace != nullptr)
+	    fclose(s_trace);
+	s_tracePath = _path;
+	s_traceSites.clear();
+	s_trace = fopen(_path.c_str(), "w");
+	if (s_trace == nullptr)
+	{
+	    SYN_CORE_WARNING("memory_log: could not open trace '" << _path << "'.");
+	    return false;
+	}
+	fprintf(s_trace, "# syn memory trace\n");
+	return true;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_log::stop_trace()
+    {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	if (s_trace != nullptr)
+	    fclose(s_trace);
+	s_trace = nullptr;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    int memory_log::_register_atfork()
+    {
+#ifdef __linux__
+	return pthread_atfork(_fork_prepare, _fork_parent, _fork_child);
+#else
+	return 0;
+#endif
+    }
+
+    void memory_log::_fork_prepare()
+    {
+	// register the forking thread first, the child can't take thread_mutex to do so
+	memory_thread::current();
+	s_mutex.lock();
+	tag_mutex().lock();
+	thread_mutex().lock();
+	// nothing buffered may be written twice
+	if (s_trace != nullptr)
+	    fflush(s_trace);
+    }
+
+    void memory_log::_fork_parent()
+    {
+	thread_mutex().unlock();
+	tag_mutex().unlock();
+	s_mutex.unlock();
+    }
+
+    void memory_log::_fork_child()
+    {
+	/* Only the forking thread exists in the child, and it holds both locks.
+	 * Records freed before the fork are dropped, the live ones are marked as
+	 * inherited and their usage moved out of the per-process counters.
+	 */
+	s_usageInherited = memory_usage();
+	for (auto& counts : s_siteCounts)
+	    counts = site_counts();
+	for (auto it = s_memory.begin(); it != s_memory.end(); )
+	{
+	    memory_alloc_info& info = it->second;
+	    if (info.is_deallocated())
+	    {
+		it = s_memory.erase(it);
+		continue;
+	    }
+	    info.m_inherited = true;
+	    s_usageInherited.update_alloc(info.m_allocBytes, info.m_allocBlock);
+	    site_count& count = s_siteCounts[info.m_site].m_inherited[(int)info.m_allocType];
+	    count.m_allocs++;
+	    count.m_allocBytes += info.m_allocBytes;
+	    count.m_allocBlock += info.m_allocBlock;
+	    ++it;
+	}
+	for (auto& usage : s_usageType)
+	    usage = memory_usage();
+	s_usageTotal = memory_usage();
+	for (auto& usage : s_usageTag)
+	    usage = memory_usage();
+	for (auto& usage : s_usageThread)
+	    usage = memory_usage();
+	for (auto& remote : s_remoteDeallocs)
+	    remote = 0;
+	s_threadMatrix.clear();
+	// no thread but the forking one exists in the child
+	thread_free_ids().clear();
+	for (uint16_t thread = 1; thread < thread_stacks().size(); thread++)
+	    if (thread != memory_thread::current())
+	    {
+		thread_stacks()[thread] = { 0, 0 };
+		if (thread != thread_overflow)
+		    thread_free_ids().push_back(thread);
+	    }
+
+	// continue the trace in a file of our own
+	if (s_trace != nullptr)
+	{
+	    fclose(s_trace);
+#ifdef __linux__
+	    s_tracePath += "." + std::to_string((long)getpid());
+#endif
+	    s_traceSites.clear();
+	    s_trace = fopen(s_tracePath.c_str(), "w");
+	    if (s_trace != nullptr)
+		fprintf(s_trace, "# syn memory trace\n");
+	}
+
+	thread_mutex().unlock();
+	tag_mutex().unlock();
+	s_mutex.unlock();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string memory_log::get_site_name(uint32_t _site)
+    {
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return _site < s_siteNames.size() ? s_siteNames[_site] : "";
+    }
+
+
     //-----------------------------------------------------------------------------------
     uint32_t memory_log::get_alloc_bytes(void* _mem_addr)
     {
+	std::lock_guard<std::mutex> lock(s_mutex);
 	auto iterator = s_memory.find(_mem_addr);
 	SYN_ASSERT(iterator != s_memory.end());
 	return iterator->second.m_allocBytes;
     }
 
 
+    //-----------------------------------------------------------------------------------
+    std::string STLMemoryResourceHandler::print_growth(bool _use_std_out) const
+    {
+	/* Final size of a container: the largest size reported by record_size(), 
+	 * or otherwise the final capacity (an upper bound, which never regrows).
+	 */
+	auto final_size = [](const MemoryResource::growth_info& _g) -> uint32_t
+	{
+	    if (_g.m_maxSize > 0) return _g.m_maxSize;
+	    return _g.m_capacityBytes / _g.m_elemSize;
+	};
+
+	struct site_growth
+	{
+	    uint32_t m_containers = 0;
+	    uint32_t m_reallocs = 0;
+	    uint64_t m_bytesCopied = 0;
+	    std::vector<uint32_t> m_finalSizes;
+	};
+	std::map<std::string, site_growth> sites;
+
+	std::vector<const MemoryResource*> containers;
+	for (auto rsrc : m_rsrcs)
+	{
+	    const MemoryResource::growth_info& g = rsrc->get_growth();
+	    if (g.m_elemSize == 0 || g.m_capacityBytes == 0)
+		continue;
+	    containers.push_back(rsrc);
+
+	    site_growth& site = sites[rsrc->get_caller_signature()];
+	    site.m_containers++;
+	    site.m_reallocs += g.m_reallocs;
+	    site.m_bytesCopied += g.m_bytesCopied;
+	    site.m_finalSizes.push_back(final_size(g));
+	}
+	std::sort(containers.begin(), containers.end(), 
+		  [](const MemoryResource* _a, const MemoryResource* _b) 
+		  { return _a->get_growth().m_bytesCopied > _b->get_growth().m_bytesCopied; });
+
+	std::ostringstream ss;
+	ss << "CONTAINER GROWTH (per container)\n";
+	ss << std::setw(4) << "";
+	ss << std::setw(73) << std::right << "CALLING FUNCTION";
+	ss << std::setw(10) << std::right << "REALLOCS";
+	ss << std::setw(14) << std::right << "COPIED";
+	ss << std::setw(12) << std::right << "CAPACITY";
+	ss << std::setw(12) << std::right << "SIZE" << "\n";
+	for (auto rsrc : containers)
+	{
+	    const MemoryResource::growth_info& g = rsrc->get_growth();
+	    ss << std::setw(4) << "";
+	    ss << std::right << std::setw(73) << rsrc->get_caller_signature();
+	    ss << std::right << std::setw(10) << g.m_reallocs;
+	    ss << std::right << std::setw(14) << memory_log::_fmt_sz(g.m_bytesCopied);
+	    ss << std::right << std::setw(12) << g.m_capacityBytes / g.m_elemSize;
+	    ss << std::right << std::setw(12) << (g.m_maxSize > 0 ? std::to_string(g.m_maxSize) : "?") << "\n";
+	}
+
+	std::vector<std::pair<std::string, site_growth*>> ranked;
+	for (auto& it : sites)
+	    ranked.push_back({ it.first, &it.second });
+	std::sort(ranked.begin(), ranked.end(), 
+		  [](const std::pair<std::string, site_growth*>& _a, const std::pair<std::string, site_growth*>& _b) 
+		  { return _a.second->m_bytesCopied > _b.second->m_bytesCopied; });
+
+	ss << "\nCONTAINER GROWTH (per call site)\n";
+	ss << std::setw(4) << "";
+	ss << std::setw(73) << std::right << "CALLING FUNCTION";
+	ss << std::setw(12) << std::right << "CONTAINERS";
+	ss << std::setw(10) << std::right << "REALLOCS";
+	ss << std::setw(14) << std::right << "COPIED";
+	ss << std::setw(20) << std::right << "RESERVE (P95)" << "\n";
+	for (auto& it : ranked)
+	{
+	    site_growth* site = it.second;
+	    std::sort(site->m_finalSizes.begin(), site->m_finalSizes.end());
+	    // nearest-rank 95th percentile
+	    size_t rank = (site->m_finalSizes.size() * 95 + 99) / 100;
+	    uint32_t p95 = site->m_finalSizes[rank > 0 ? rank - 1 : 0];
+	    ss << std::setw(4) << "";
+	    ss << std::right << std::setw(73) << it.first;
+	    ss << std::right << std::setw(12) << site->m_containers;
+	    ss << std::right << std::setw(10) << site->m_reallocs;
+	    ss << std::right << std::setw(14) << memory_log::_fmt_sz(site->m_bytesCopied);
+	    ss << std::right << std::setw(20) << (site->m_reallocs > 0 ? std::to_string(p95) : "-") << "\n";
+	}
+
+	std::string exp = ss.str();
+	if (_use_std_out)
+	    std::cout << exp;
+
+	return exp;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    uint16_t memory_tag::get(const char* _name)
+    {
+	std::lock_guard<std::mutex> lock(tag_mutex());
+	auto it = tag_ids().find(_name);
+	if (it != tag_ids().end())
+	    return it->second;
+	SYN_ASSERT(tag_names().size() < UINT16_MAX);
+	uint16_t tag = (uint16_t)tag_names().size();
+	tag_names().push_back(_name);
+	tag_ids()[_name] = tag;
+	return tag;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string memory_tag::name(uint16_t _tag)
+    {
+	std::lock_guard<std::mutex> lock(tag_mutex());
+	return _tag < tag_names().size() ? tag_names()[_tag] : "";
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    uint16_t memory_tag::count()
+    {
+	std::lock_guard<std::mutex> lock(tag_mutex());
+	return (uint16_t)tag_names().size();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    /* Budget slots: one per AllocType, followed by one per memory_tag. A slot 
+     * without a hard limit still tracks usage, against an unreachable limit.
+     */
+    static constexpr int64_t BUDGET_UNLIMITED = INT64_MAX / 4;
+    static constexpr uint16_t BUDGET_TYPE_SLOTS = 4;
+    static constexpr uint16_t BUDGET_SLOTS = BUDGET_TYPE_SLOTS + memory_budget::MAX_TAGS;
+
+    struct budget_slot
+    {
+	std::atomic<int64_t> m_available { 0 };     // limit minus reserved bytes
+	std::atomic<int64_t> m_limit { BUDGET_UNLIMITED };
+	std::atomic<int64_t> m_soft { 0 };
+	std::atomic<bool> m_softExceeded { false };
+	std::atomic<int64_t> m_lastSoftCall { INT64_MIN / 2 };
+    };
+    static budget_slot s_budgets[BUDGET_SLOTS];
+
+    static std::atomic<memory_budget::soft_limit_func> s_softLimitFunc { nullptr };
+    static std::atomic<memory_budget::hard_limit_func> s_hardLimitFunc { nullptr };
+    static std::atomic<int64_t> s_softLimitInterval { 1000 };
+
+    // per-thread reservations, returned to the budgets on thread exit
+    struct budget_cache
+    {
+	int64_t m_credit[BUDGET_SLOTS] = { 0 };
+	~budget_cache()
+	{
+	    for (uint16_t i = 0; i < BUDGET_SLOTS; i++)
+		if (m_credit[i] > 0)
+		    s_budgets[i].m_available.fetch_add(m_credit[i], std::memory_order_relaxed);
+	}
+    };
+    static thread_local budget_cache t_budgetCache;
+
+    static inline AllocType budget_slot_type(uint16_t _slot) { return _slot < BUDGET_TYPE_SLOTS ? (AllocType)_slot : AllocType::NONE; }
+    static inline uint16_t budget_slot_tag(uint16_t _slot) { return _slot < BUDGET_TYPE_SLOTS ? 0 : _slot - BUDGET_TYPE_SLOTS; }
+
+    static void budget_check_soft(uint16_t _slot)
+    {
+	budget_slot& b = s_budgets[_slot];
+	int64_t soft = b.m_soft.load(std::memory_order_relaxed);
+	if (soft == 0)
+	    return;
+	int64_t limit = b.m_limit.load(std::memory_order_relaxed);
+	int64_t used = limit - b.m_available.load(std::memory_order_relaxed);
+	if (used <= soft)
+	{
+	    b.m_softExceeded.store(false, std::memory_order_relaxed);
+	    return;
+	}
+	if (b.m_softExceeded.exchange(true, std::memory_order_relaxed))
+	    return;
+	// new crossing, notify unless the last notification was too recent
+	memory_budget::soft_limit_func func = s_softLimitFunc.load();
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	int64_t last = b.m_lastSoftCall.load(std::memory_order_relaxed);
+	if (func != nullptr && now - last >= s_softLimitInterval.load(std::memory_order_relaxed) &&
+	    b.m_lastSoftCall.compare_exchange_strong(last, now))
+	    func(budget_slot_type(_slot), budget_slot_tag(_slot), (uint64_t)used, (uint64_t)soft);
+    }
+
+    // Take _bytes from the reservation of _slot, refilling it from the budget if needed.
+    static bool budget_take(uint16_t _slot, int64_t _bytes)
+    {
+	int64_t& credit = t_budgetCache.m_credit[_slot];
+	if (credit >= _bytes)
+	{
+	    credit -= _bytes;
+	    return true;
+	}
+	budget_slot& b = s_budgets[_slot];
+	int64_t need = _bytes - credit;
+	// refill with some headroom, or fall back to exactly what is needed
+	for (int64_t refill : { need + memory_budget::REFILL_BYTES, need })
+	{
+	    if (b.m_available.fetch_sub(refill, std::memory_order_relaxed) >= refill)
+	    {
+		credit += refill - _bytes;
+		budget_check_soft(_slot);
+		return true;
+	    }
+	    b.m_available.fetch_add(refill, std::memory_order_relaxed);
+	}
+	return false;
+    }
+
+    static void budget_give(uint16_t _slot, int64_t _bytes)
+    {
+	int64_t& credit = t_budgetCache.m_credit[_slot];
+	credit += _bytes;
+	if (credit > 2 * memory_budget::REFILL_BYTES)
+	{
+	    s_budgets[_slot].m_available.fetch_add(credit - memory_budget::REFILL_BYTES, std::memory_order_relaxed);
+	    credit = memory_budget::REFILL_BYTES;
+	    budget_check_soft(_slot);
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_budget::_charge(AllocType _alloc_type, uint16_t _tag, int64_t _bytes)
+    {
+	uint16_t type_slot = (uint16_t)_alloc_type;
+	uint16_t tag_slot = _tag > 0 && _tag < MAX_TAGS ? BUDGET_TYPE_SLOTS + _tag : 0;
+
+	uint16_t failed_slot = BUDGET_SLOTS;
+	if (!budget_take(type_slot, _bytes))
+	    failed_slot = type_slot;
+	else if (tag_slot > 0 && !budget_take(tag_slot, _bytes))
+	{
+	    budget_give(type_slot, _bytes);
+	    failed_slot = tag_slot;
+	}
+	if (failed_slot == BUDGET_SLOTS)
+	    return;
+
+	// hard limit exceeded: the handler may allow the allocation anyway
+	hard_limit_func func = s_hardLimitFunc.load();
+	if (func == nullptr || !func(budget_slot_type(failed_slot), budget_slot_tag(failed_slot), (std::size_t)_bytes))
+	    throw std::bad_alloc{};
+	s_budgets[type_slot].m_available.fetch_sub(_bytes, std::memory_order_relaxed);
+	if (tag_slot > 0)
+	    s_budgets[tag_slot].m_available.fetch_sub(_bytes, std::memory_order_relaxed);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_budget::_credit(AllocType _alloc_type, uint16_t _tag, int64_t _bytes)
+    {
+	budget_give((uint16_t)_alloc_type, _bytes);
+	if (_tag > 0 && _tag < MAX_TAGS)
+	    budget_give(BUDGET_TYPE_SLOTS + _tag, _bytes);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_budget::_enable()
+    {
+	/* Start accounting from the current live allocations, which are marked 
+	 * as budgeted so that their deallocations are credited.
+	 */
+	std::lock_guard<std::mutex> lock(memory_log::s_mutex);
+	if (s_enabled.load())
+	    return;
+	int64_t live[BUDGET_SLOTS] = { 0 };
+	for (auto& it : memory_log::s_memory)
+	{
+	    memory_alloc_info& info = it.second;
+	    if (info.is_deallocated())
+		continue;
+	    info.m_budgeted = true;
+	    live[(int)info.m_allocType] += info.m_allocBytes;
+	    if (info.m_tag > 0 && info.m_tag < MAX_TAGS)
+		live[BUDGET_TYPE_SLOTS + info.m_tag] += info.m_allocBytes;
+	}
+	for (uint16_t i = 0; i < BUDGET_SLOTS; i++)
+	    s_budgets[i].m_available.store(s_budgets[i].m_limit.load() - live[i]);
+	s_enabled.store(true);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    static void budget_set_limit(uint16_t _slot, uint64_t _soft, uint64_t _hard)
+    {
+	budget_slot& b = s_budgets[_slot];
+	int64_t limit = _hard > 0 ? (int64_t)_hard : BUDGET_UNLIMITED;
+	int64_t prev = b.m_limit.exchange(limit);
+	b.m_available.fetch_add(limit - prev);
+	b.m_soft.store((int64_t)_soft);
+	b.m_softExceeded.store(false);
+    }
+
+    void memory_budget::set_limit(AllocType _alloc_type, uint64_t _soft, uint64_t _hard)
+    {
+	_enable();
+	budget_set_limit((uint16_t)_alloc_type, _soft, _hard);
+    }
+
+    void memory_budget::set_limit(uint16_t _tag, uint64_t _soft, uint64_t _hard)
+    {
+	SYN_ASSERT(_tag > 0 && _tag < MAX_TAGS);
+	if (_tag == 0 || _tag >= MAX_TAGS)
+	    return;
+	_enable();
+	budget_set_limit(BUDGET_TYPE_SLOTS + _tag, _soft, _hard);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_budget::set_soft_limit_callback(soft_limit_func _func, uint32_t _min_interval_ms)
+    {
+	s_softLimitInterval.store(_min_interval_ms);
+	s_softLimitFunc.store(_func);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_budget::set_hard_limit_handler(hard_limit_func _func)
+    {
+	s_hardLimitFunc.store(_func);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    uint16_t memory_thread::_register()
+    {
+	std::ostringstream ss;
+#ifdef __linux__
+	ss << "thread-" << (long)syscall(SYS_gettid);
+#elif defined(_WIN32)
+	ss << "thread-" << (long)GetCurrentThreadId();
+#endif
+
+	std::pair<uintptr_t, uintptr_t> bounds = { 0, 0 };
+#ifdef __linux__
+	pthread_attr_t attr;
+	if (syscall(SYS_gettid) != getpid() && pthread_getattr_np(pthread_self(), &attr) == 0)
+	{
+	    void* stack_addr = nullptr;
+	    size_t stack_size = 0;
+	    if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0)
+		bounds = { (uintptr_t)stack_addr, (uintptr_t)stack_addr + stack_size };
+	    pthread_attr_destroy(&attr);
+	}
+#endif
+
+	/* Ids are handed out in order, so that reports of short-lived processes
+	 * keep one id per thread. Once they are used up, the ids of exited threads
+	 * are reused, and without any, threads share the overflow id (whose stack
+	 * is not scanned).
+	 */
+	std::lock_guard<std::mutex> lock(thread_mutex());
+	uint16_t thread;
+	if (thread_names().size() < thread_overflow)
+	{
+	    thread = (uint16_t)thread_names().size();
+	    thread_names().push_back(ss.str());
+	    thread_stacks().push_back(bounds);
+	}
+	else if (!thread_free_ids().empty())
+	{
+	    thread = thread_free_ids().back();
+	    thread_free_ids().pop_back();
+	    thread_names()[thread] = ss.str();
+	    thread_stacks()[thread] = bounds;
+	}
+	else
+	{
+	    if (thread_names().size() == thread_overflow)
+	    {
+		thread_names().push_back("(overflow)");
+		thread_stacks().push_back({ 0, 0 });
+	    }
+	    return thread_overflow;
+	}
+	s_threadExit.m_thread = thread;
+	return thread;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void memory_thread::set_name(uint16_t _thread, const std::string& _name)
+    {
+	std::lock_guard<std::mutex> lock(thread_mutex());
+	if (_thread < thread_names().size())
+	    thread_names()[_thread] = _name;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string memory_thread::name(uint16_t _thread)
+    {
+	std::lock_guard<std::mutex> lock(thread_mutex());
+	return _thread < thread_names().size() ? thread_names()[_thread] : "";
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    uint16_t memory_thread::count()
+    {
+	std::lock_guard<std::mutex> lock(thread_mutex());
+	return (uint16_t)thread_names().size();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::vector<memory_thread::stack_bounds> memory_thread::get_stacks()
+    {
+	std::lock_guard<std::mutex> lock(thread_mutex());
+	std::vector<stack_bounds> stacks;
+	for (uint16_t thread = 0; thread < thread_stacks().size(); thread++)
+	    if (thread_stacks()[thread].second > thread_stacks()[thread].first)
+		stacks.push_back({ thread, thread_stacks()[thread].first, thread_stacks()[thread].second });
+	return stacks;
+    }
+
+
     //-----------------------------------------------------------------------------------
     std::string pretty_func(const char* _fnc)
     {
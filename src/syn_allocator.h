@@ -8,7 +8,12 @@
 #include <unordered_map>
 
 #include <memory>
+#include <new>		// std::align_val_t, std::bad_array_new_length
+#include <type_traits>
+#include <stdint.h>
 #include <memory_resource>
+#include <mutex>
+#include <atomic>
 #include <assert.h>
 #include <cstddef>	// for std::max_align_t
 
@@ -54,6 +59,22 @@ namespace Syn {
     extern std::string format_mem_addr(void* _mem_addr, uint8_t _width=16);
 
 
+    /*
+     * glibc (ptmalloc) size class of a request, i.e. the chunk the request is
+     * rounded up to and the usable bytes of that chunk, and which bin it is
+     * recycled through when freed.
+     */
+    struct malloc_size_class
+    {
+	uint32_t m_chunk;	// chunk size, including malloc header
+	uint32_t m_usable;	// malloc_usable_size() of the chunk
+	uint32_t m_prevUsable;	// usable bytes of the next smaller class (0 if none)
+	const char* m_bin;	// "tcache", "large" or "mmap"
+	uint32_t m_binIndex;	// tcache bin index (only for "tcache")
+    };
+    extern malloc_size_class get_malloc_size_class(uint32_t _bytes);
+
+
     //
     enum class AllocType
     {
@@ -86,6 +107,13 @@ namespace Syn {
 	uint32_t m_deallocBytes;
 	uint32_t m_deallocBlock;
 	AllocType m_allocType;
+	uint16_t m_tag;                 // memory_tag charged for the allocation
+	uint16_t m_allocThread = 0;     // memory_thread ids of the allocating
+	uint16_t m_deallocThread = 0;   // and the deallocating (0 if live) threads
+	bool m_budgeted = false;        // charged to memory_budget
+	bool m_inherited = false;       // allocated by the parent, before fork()
+	uint32_t m_alignment = 0;       // alignment passed to aligned new (0 if none)
+	uint32_t m_site = 0;            // interned m_callerFnc (memory_log::get_site_name())
 	std::string m_callerFnc;
 
 	memory_alloc_info() : 
@@ -94,6 +122,7 @@ namespace Syn {
 	    m_deallocBytes(0), 
 	    m_deallocBlock(0),
 	    m_allocType(AllocType::NONE),
+	    m_tag(0),
 	    m_callerFnc("")
 	{}
 
@@ -102,45 +131,158 @@ namespace Syn {
 			  uint32_t _dealloc_bytes=0,
 			  uint32_t _dealloc_block=0,
 			  AllocType _alloc_type=AllocType::NONE,
-			  const std::string& _caller_fnc="") :
+			  const std::string& _caller_fnc="",
+			  uint16_t _tag=0) :
 	    m_allocBytes(_alloc_bytes), 
 	    m_allocBlock(_alloc_block),
 	    m_deallocBytes(_dealloc_bytes), 
 	    m_deallocBlock(_dealloc_block),
 	    m_allocType(_alloc_type),
+	    m_tag(_tag),
 	    m_callerFnc(_caller_fnc)
 	{}
+
+	inline bool is_deallocated() const
+	{ return m_allocBytes == m_deallocBytes && m_allocBlock == m_deallocBlock; }
     };
 
 
     /*
-     * Helper struct for the memory_log.
+     * Helper struct for the memory_log. The totals are 64 bit, as a busy tag or
+     * thread allocates more than 4 GiB (or 4G times) in minutes.
      */
     struct memory_usage
     {
-	uint32_t m_physicalAlloc;
-	uint32_t m_virtualAlloc;
-	uint32_t m_physicalDealloc;
-	uint32_t m_virtualDealloc;
+	uint64_t m_physicalAlloc;
+	uint64_t m_virtualAlloc;
+	uint64_t m_physicalDealloc;
+	uint64_t m_virtualDealloc;
+	uint64_t m_physicalPeak;        // high-water mark of live raw bytes
+	uint64_t m_allocCount;
+	uint64_t m_deallocCount;
 
 	memory_usage() :
 	    m_physicalAlloc(0), m_virtualAlloc(0),
-	    m_physicalDealloc(0), m_virtualDealloc(0)
+	    m_physicalDealloc(0), m_virtualDealloc(0),
+	    m_physicalPeak(0), m_allocCount(0), m_deallocCount(0)
 	{}
 
 	inline void update_alloc(uint32_t _mem_bytes, uint32_t _mem_block) 
 	{ 
 	    m_physicalAlloc += _mem_bytes; 
 	    m_virtualAlloc  += _mem_block;
+	    m_allocCount++;
+	    if (m_physicalAlloc - m_physicalDealloc > m_physicalPeak)
+		m_physicalPeak = m_physicalAlloc - m_physicalDealloc;
 	}
 	inline void update_dealloc(uint32_t _mem_bytes, uint32_t _mem_block)
 	{
 	    m_physicalDealloc += _mem_bytes;
 	    m_virtualDealloc  += _mem_block;
+	    m_deallocCount++;
 	}
     };
 
 
+    /*
+     * Allocation tags, naming the subsystem that owns an allocation (as opposed to
+     * AllocType, which names how it was allocated). Tags are registered once by name
+     * and pushed on a per-thread stack by Syn::MemoryScope; every tracked allocation 
+     * is charged to the innermost tag of the allocating thread. Tag 0 is "untagged".
+     */
+    class memory_tag
+    {
+    public:
+	static constexpr uint16_t MAX_DEPTH = 32;
+
+	// Get the id of tag _name, registering it if needed.
+	static uint16_t get(const char* _name);
+	// Name of tag _tag ("" for untagged).
+	static std::string name(uint16_t _tag);
+	// Number of registered tags, including the untagged tag 0.
+	static uint16_t count();
+
+	// Innermost tag of the calling thread.
+	static inline uint16_t current()
+	{
+	    if (s_depth == 0) return 0;
+	    return s_stack[(s_depth <= MAX_DEPTH ? s_depth : MAX_DEPTH) - 1];
+	}
+	// Scopes nested deeper than MAX_DEPTH are charged to the tag at MAX_DEPTH.
+	static inline void push(uint16_t _tag)
+	{
+	    if (s_depth < MAX_DEPTH) s_stack[s_depth] = _tag;
+	    s_depth++;
+	}
+	static inline void pop() { SYN_ASSERT(s_depth > 0); s_depth--; }
+
+    private:
+	static thread_local uint16_t s_stack[MAX_DEPTH];
+	static thread_local uint16_t s_depth;
+    };
+
+
+    /*
+     * Compact (16 bit) thread ids for attributing allocations, assigned on first
+     * use as 1, 2, ... Threads are named "thread-<tid>" in reports, unless named
+     * with Syn::set_thread_name(). The stack bounds of a registered thread are
+     * kept until it exits, as roots for leak_scan.
+     */
+    class memory_thread
+    {
+    public:
+	struct stack_bounds
+	{
+	    uint16_t m_thread;
+	    uintptr_t m_begin;
+	    uintptr_t m_end;
+	};
+
+	// Id of the calling thread (ids of exited threads are reused once all
+	// 65534 have been handed out, after which threads share an overflow id).
+	static inline uint16_t current()
+	{
+	    if (s_id == 0) s_id = _register();
+	    return s_id;
+	}
+	static void set_name(uint16_t _thread, const std::string& _name);
+	static std::string name(uint16_t _thread);
+	// Number of registered threads, including the unused id 0.
+	static uint16_t count();
+	// Stacks of the registered threads still running, except the main thread
+	// (whose stack is the [stack] mapping of the process).
+	static std::vector<stack_bounds> get_stacks();
+
+    private:
+	static uint16_t _register();
+
+    private:
+	static thread_local uint16_t s_id;
+    };
+
+    // Name the calling thread in reports, e.g. "io-worker-3".
+    static inline void set_thread_name(const std::string& _name) { memory_thread::set_name(memory_thread::current(), _name); }
+
+
+    /*
+     * RAII allocation scope, e.g.
+     *      Syn::MemoryScope scope("request_parser");
+     * For hot scopes, prefer SYN_MEMORY_SCOPE("request_parser"), which only looks
+     * up the tag once per call site, making a scope a push and a pop of a
+     * thread-local stack.
+     */
+    class MemoryScope
+    {
+    public:
+	explicit MemoryScope(const char* _name) { memory_tag::push(memory_tag::get(_name)); }
+	explicit MemoryScope(uint16_t _tag) { memory_tag::push(_tag); }
+	~MemoryScope() { memory_tag::pop(); }
+
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator=(const MemoryScope&) = delete;
+    };
+
+
     /*
      * The memory tracking record.
      */
@@ -148,33 +290,86 @@ namespace Syn {
     {
     public:
 	// Insert a new allocation into record.
-	static void insert(void* _mem_addr, uint32_t _alloc_bytes, uint32_t _alloc_block, AllocType _alloc_type, const std::string& _caller_fnc);
+	static void insert(void* _mem_addr, uint32_t _alloc_bytes, uint32_t _alloc_block, AllocType _alloc_type, const std::string& _caller_fnc)
+	{ insert(_mem_addr, _alloc_bytes, _alloc_block, _alloc_type, _caller_fnc, 0); }
+	// Insert an allocation made by aligned new, with its _alignment.
+	static void insert(void* _mem_addr, uint32_t _alloc_bytes, uint32_t _alloc_block, AllocType _alloc_type, const std::string& _caller_fnc, uint32_t _alignment);
 	// Remove (deallocation) an allocation from record.
 	static void remove(void* _mem_addr, uint32_t _dealloc_bytes, uint32_t _dealloc_block, AllocType _alloc_type);
+	// Remove an allocation using its recorded sizes, in a single lookup. Returns
+	// the allocated raw bytes, and the alignment in _alignment, for sized deallocation.
+	static uint32_t release(void* _mem_addr, AllocType _alloc_type, uint32_t* _alignment=nullptr);
 
 	// Heap usage accessors.
 	static const memory_usage& get_usage_alloc_type(AllocType _alloc_type) { return s_usageType[(int)_alloc_type]; }
 	static const memory_usage& get_usage_total() { return s_usageTotal; }		
+	static memory_usage get_usage_tag(uint16_t _tag);
+	static memory_usage get_usage_thread(uint16_t _thread);
+	// Usage of the allocations inherited from the parent process at fork().
+	static const memory_usage& get_usage_inherited() { return s_usageInherited; }
 	// Print memory allocations, sorted on AllocType.
 	static const std::string& print_alloc_all(bool _omit_deallocated=true, bool _use_std_out=false);
 	// Print memory allocations of AllocType _alloc_type.
 	static std::string print_alloc_type(AllocType _alloc_type, bool _omit_deallocated);
+	// Print live, peak and total usage per memory_tag.
+	static std::string print_alloc_tags();
+	// Print usage per allocating thread, and for every call site with cross-
+	// thread deallocations, the allocating versus deallocating thread matrix.
+	static std::string print_alloc_threads();
+	// Print call sites ranked by wasted bytes (block - requested), their glibc size
+	// classes and suggested request sizes, followed by process-level malloc statistics.
+	static std::string print_slack_analysis(bool _omit_deallocated=true, bool _use_std_out=false);
 	// Get allocated bytes at memory adress _mem_addr.
 	static uint32_t get_alloc_bytes(void* _mem_addr);
+	// Write the report (print_alloc_all) to <_prefix>.<pid>.txt and the per call
+	// site profile to <_prefix>.<pid>.tsv, as read by tools/merge_reports.
+	static bool write_report(const std::string& _prefix, bool _omit_deallocated=true);
+
+	/* Record every tracked allocation and deallocation, in order, to _path,
+	 * for replay by tools/replay_trace and for pool_config::generate(). Each
+	 * line is an event or the definition of a call site:
+	 *      s <site> <caller signature>
+	 *      a <thread> <address> <bytes> <site>
+	 *      f <thread> <address>
+	 * After fork(), a child continues the trace in <_path>.<pid>.
+	 */
+	static bool start_trace(const std::string& _path);
+	static void stop_trace();
+
+	// Caller signature of interned call site _site.
+	static std::string get_site_name(uint32_t _site);
 
 	// Map of all allocated memory addresses and their size
 	static const std::unordered_map<void*, memory_alloc_info>& get_memory() { return s_memory; } 
 
     private:
-	// formatting of bytes into kb and mb
-	static inline const std::string& _fmt_sz(uint32_t _bytes)
+	friend class STLMemoryResourceHandler;
+	friend class memory_budget;
+	friend class leak_scan;
+	friend class report_writer;
+
+	// mark the record _info as deallocated and update memory usage (the callers
+	// credit memory_budget, after releasing the lock)
+	static void _remove(memory_alloc_info& _info, uint32_t _dealloc_bytes, uint32_t _dealloc_block, AllocType _alloc_type);
+
+	/* pthread_atfork() handlers: the record is locked across fork(), so that 
+	 * the child gets a consistent copy, in which the live allocations are 
+	 * marked as inherited and the usage counters start from zero.
+	 */
+	static int _register_atfork();
+	static void _fork_prepare();
+	static void _fork_parent();
+	static void _fork_child();
+
+	// formatting of bytes into kb, mb and gb (64 bit, for process-level sizes)
+	static inline const std::string& _fmt_sz(uint64_t _bytes)
 	{
-	    static constexpr uint32_t mb = 1024 * 1024;
+	    static constexpr uint64_t mb = 1024 * 1024;
 	    std::ostringstream ss;
 	    if (_bytes <= 1024)	       ss << _bytes << " B";
-	    else if (_bytes < mb)      ss << std::fixed << std::setprecision(2) << (float)_bytes / 1024.0f << " K";
-	    else if (_bytes < 1024*mb) ss << std::fixed << std::setprecision(2) << (float)_bytes / (float)mb << " M";
-	    else		       ss << std::fixed << std::setprecision(2) << (float)_bytes / ((float)mb * 1024.0f) << " G";
+	    else if (_bytes < mb)      ss << std::fixed << std::setprecision(2) << (double)_bytes / 1024.0 << " K";
+	    else if (_bytes < 1024*mb) ss << std::fixed << std::setprecision(2) << (double)_bytes / (double)mb << " M";
+	    else		       ss << std::fixed << std::setprecision(2) << (double)_bytes / ((double)mb * 1024.0) << " G";
 	    s_sz = ss.str();
 	    return s_sz;
 	}
@@ -183,8 +378,82 @@ namespace Syn {
 	static std::unordered_map<void*, memory_alloc_info> s_memory;
 	static memory_usage s_usageType[4];
 	static memory_usage s_usageTotal;
+	static std::vector<memory_usage> s_usageTag;
+	// usage per allocating thread, and deallocations of other threads' memory
+	static std::vector<memory_usage> s_usageThread;
+	static std::vector<uint32_t> s_remoteDeallocs;
+	// call sites, interned on insert, so that a free only deals with a site id
+	static std::unordered_map<std::string, uint32_t> s_siteIds;
+	static std::vector<std::string> s_siteNames;
+	// per call site id and AllocType: all allocations and frees, which, unlike
+	// the records, are not lost when an address is reused
+	struct site_count { uint64_t m_allocs = 0, m_frees = 0, m_allocBytes = 0, m_allocBlock = 0; };
+	struct site_counts { site_count m_own[4]; site_count m_inherited[4]; };
+	static std::vector<site_counts> s_siteCounts;
+	// per call site id: (allocating, deallocating) thread -> cross-thread deallocations (bytes)
+	struct thread_pair_count { uint32_t m_count = 0; uint64_t m_bytes = 0; };
+	static std::unordered_map<uint32_t, std::map<std::pair<uint16_t, uint16_t>, thread_pair_count>> s_threadMatrix;
+	static memory_usage s_usageInherited;
 	static std::string s_sz;
+	// guards the record and the usage counters
+	static std::mutex s_mutex;
 	static std::string s_lastLogEntry;
+	static int s_atforkRegistered;
+	// allocation trace (nullptr if not tracing)
+	static FILE* s_trace;
+	static std::string s_tracePath;
+	// call sites defined in the trace, by site id
+	static std::vector<bool> s_traceSites;
+    };
+
+
+    /*
+     * Memory budgets: soft and hard limits on the live (raw) bytes of an AllocType
+     * or a memory_tag. Crossing a soft limit invokes the soft limit callback (once 
+     * per crossing, rate limited); an allocation that would exceed a hard limit 
+     * calls the hard limit handler, or throws std::bad_alloc if there is none or 
+     * it returns false. Neither is called with the record lock held, so both may
+     * make tracked allocations.
+     *
+     * To keep the check off the global lock, each thread charges allocations to a
+     * thread-local reservation, refilled in REFILL_BYTES chunks from an atomic 
+     * budget. Limits are hence enforced to within REFILL_BYTES per thread, and the
+     * usage seen by the soft limit includes unspent reservations. Limits should be 
+     * configured at startup, before allocating threads are started.
+     */
+    class memory_budget
+    {
+    public:
+	// _tag is 0 for AllocType budgets.
+	typedef void (*soft_limit_func)(AllocType _alloc_type, uint16_t _tag, uint64_t _used, uint64_t _limit);
+	// Return true to let the allocation exceed the hard limit.
+	typedef bool (*hard_limit_func)(AllocType _alloc_type, uint16_t _tag, std::size_t _bytes);
+
+	static constexpr uint16_t MAX_TAGS = 256;
+	static constexpr int64_t REFILL_BYTES = 64 * 1024;
+
+	// Set soft and hard limits, in bytes (0 for no limit).
+	static void set_limit(AllocType _alloc_type, uint64_t _soft, uint64_t _hard);
+	static void set_limit(uint16_t _tag, uint64_t _soft, uint64_t _hard);
+	static void set_limit(const char* _tag, uint64_t _soft, uint64_t _hard) { set_limit(memory_tag::get(_tag), _soft, _hard); }
+	static void set_soft_limit_callback(soft_limit_func _func, uint32_t _min_interval_ms=1000);
+	static void set_hard_limit_handler(hard_limit_func _func);
+
+	static inline bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+	// Charge _bytes to the AllocType and the current memory_tag before allocating.
+	static inline void charge(AllocType _alloc_type, std::size_t _bytes)
+	{ if (enabled()) _charge(_alloc_type, memory_tag::current(), (int64_t)_bytes); }
+	// Credit _bytes back to the budgets charged by the allocation.
+	static inline void credit(AllocType _alloc_type, uint16_t _tag, std::size_t _bytes)
+	{ _credit(_alloc_type, _tag, (int64_t)_bytes); }
+
+    private:
+	static void _charge(AllocType _alloc_type, uint16_t _tag, int64_t _bytes);
+	static void _credit(AllocType _alloc_type, uint16_t _tag, int64_t _bytes);
+	static void _enable();
+
+    private:
+	static std::atomic<bool> s_enabled;
     };
 
 
@@ -212,13 +481,34 @@ namespace Syn {
 	    m_removeFunc = _remove_func;
 	    m_allocType = _malloc_type;
 	    m_memory = _memory;
+	    m_mallocBacked = _memory == std::pmr::new_delete_resource();
 	}
 	// override the allocation and deallocation functions
 	void* do_allocate(std::size_t _bytes, 
 			  std::size_t _alignment=alignof(std::max_align_t)) override
 	{
-	    void* ptr = m_memory->allocate(_bytes, _alignment);
-	    m_insertFunc(ptr, _bytes, malloc_size_func((void*)ptr), m_allocType, m_lastCaller);
+	    memory_budget::charge(m_allocType, _bytes);
+	    void* ptr = nullptr;
+	    try { ptr = m_memory->allocate(_bytes, _alignment); }
+	    catch (...)
+	    {
+		if (memory_budget::enabled()) memory_budget::credit(m_allocType, memory_tag::current(), _bytes);
+		throw;
+	    }
+	    m_insertFunc(ptr, _bytes, m_mallocBacked ? malloc_size_func((void*)ptr) : (uint32_t)_bytes, m_allocType, m_lastCaller);
+
+	    // a new buffer while the previous one is still live is a container regrowth,
+	    // the contents of the previous buffer is copied (moved) into the new one.
+	    if (m_growth.m_elemSize > 0)
+	    {
+		if (m_growth.m_liveAllocs > 0)
+		{
+		    m_growth.m_reallocs++;
+		    m_growth.m_bytesCopied += m_growth.m_capacityBytes;
+		}
+		m_growth.m_capacityBytes = (uint32_t)_bytes;
+		m_growth.m_liveAllocs++;
+	    }
 
 	    // assert(m_allocType != AllocType::NONE);
 	    return ptr;
@@ -229,14 +519,34 @@ namespace Syn {
 			   std::size_t _alignment=alignof(std::max_align_t)) override
 	{
 	    //assert(m_allocType != AllocType::NONE);
-	    m_removeFunc(_ptr, _bytes, malloc_size_func(_ptr), m_allocType);
+	    m_removeFunc(_ptr, _bytes, m_mallocBacked ? malloc_size_func(_ptr) : (uint32_t)_bytes, m_allocType);
 	    m_memory->deallocate(_ptr, _bytes, _alignment);
+	    if (m_growth.m_elemSize > 0)
+		m_growth.m_liveAllocs--;
 	}
 
 	bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override { return this == &_other; }
 
 	// set caller signature
 	void set_caller_signature(const std::string& _caller_sig) { m_lastCaller = _caller_sig.c_str(); }
+	const std::string& get_caller_signature() const { return m_lastCaller; }
+
+	/* Growth chain of a single-buffer container (i.e. Syn::vector). Growth is
+	 * only tracked when the element size is set, since node-based containers
+	 * have several live allocations per resource by design.
+	 */
+	struct growth_info
+	{
+	    uint32_t m_elemSize = 0;            // sizeof(T), 0 if not tracked
+	    uint32_t m_reallocs = 0;            // number of regrowths
+	    uint64_t m_bytesCopied = 0;         // bytes of the buffers grown out of
+	    uint32_t m_capacityBytes = 0;       // bytes of the last buffer
+	    uint32_t m_liveAllocs = 0;
+	    uint32_t m_maxSize = 0;             // largest size reported by record_size()
+	};
+	void set_element_size(uint32_t _elem_size) { m_growth.m_elemSize = _elem_size; }
+	void record_size(std::size_t _size) { if (_size > m_growth.m_maxSize) m_growth.m_maxSize = (uint32_t)_size; }
+	const growth_info& get_growth() const { return m_growth; }
 
 
     private:
@@ -249,6 +559,10 @@ namespace Syn {
 	std::string m_lastCaller = "";
 	// pointer to the global heap
 	std::pmr::memory_resource* m_memory = nullptr;
+	// malloc_size_func() only applies to memory from the global heap
+	bool m_mallocBacked = true;
+	// reallocation history (Syn::vector only)
+	growth_info m_growth;
     };
 
 	
@@ -292,6 +606,9 @@ namespace Syn {
 	// created pointers and the MemoryResource:s they point to.
 	constexpr std::size_t getMemSize() const
 	{ return sizeof(STLMemoryResourceHandler) + m_rsrcs.size() * (sizeof(MemoryResource*) + sizeof(MemoryResource)); }
+	// Print the growth chains of all Syn::vector:s, per container and per call
+	// site, with a recommended reserve() (95th percentile of the final sizes).
+	std::string print_growth(bool _use_std_out=false) const;
 
     private:
 	std::vector<MemoryResource*> m_rsrcs;
@@ -327,9 +644,19 @@ namespace Syn {
     {
 	MemoryResource* rsrc = s_STLMemRsrcHandler.getNewMemoryResource();
 	rsrc->set_caller_signature(get_caller_signature(_c_file, _c_line, _c_fnc, "Syn::vector"));
+	rsrc->set_element_size(sizeof(T));
 	vector<T> v(0, rsrc);
 	return v;
     }
+    // Report the current size of a Syn::vector to its growth record, giving the
+    // exact final size for the reserve() recommendation of print_growth().
+    template<typename T>
+    static inline void record_size(const vector<T>& _v)
+    {
+	MemoryResource* rsrc = dynamic_cast<MemoryResource*>(_v.get_allocator().resource());
+	if (rsrc != nullptr)
+	    rsrc->record_size(_v.size());
+    }
     // list
     template<typename T>
     static inline list<T> _syn_list(const char* _c_file, const char* _c_line, const char* _c_fnc)
@@ -364,6 +691,8 @@ namespace Syn {
 	vector<T> v(0, s_memorySTL);
 	return v;
     }
+    template<typename T>
+    static inline void record_size(const vector<T>&) {}
     // list
     template<typename T>
     static inline list<T> _syn_list()
@@ -396,6 +725,9 @@ namespace Syn {
     using map = std::map<K, T>;
     template<typename K, typename T>
     using unordered_map = std::unordered_map<K, T>;
+
+    template<typename T>
+    static inline void record_size(const vector<T>&) {}
 #endif
 
 
@@ -445,30 +777,123 @@ namespace Syn {
     /* Wrappers for explicit memory allocation.
      */
 #ifdef DEBUG_MEMORY_ALLOC
+
+    /* Objects are allocated with the global operator new (::new T, bypassing a
+     * class-specific operator new), as they are freed with the global operator
+     * delete. Over-aligned types (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+     * are allocated and freed with the std::align_val_t overloads, as new T does.
+     */
+    template<typename T>
+    static constexpr uint32_t _new_alignment()
+    {
+#ifdef __cpp_aligned_new
+	return alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? (uint32_t)alignof(T) : 0;
+#else
+	return 0;
+#endif
+    }
+
+    static inline void* _operator_new_n(std::size_t _bytes, uint32_t _alignment)
+    {
+#ifdef __cpp_aligned_new
+	if (_alignment > 0)
+	    return ::operator new[](_bytes, std::align_val_t(_alignment));
+#endif
+	(void)_alignment;
+	return ::operator new[](_bytes);
+    }
+
+    // sized deallocation, where available
+    static inline void _operator_delete(void* _ptr, std::size_t _bytes, uint32_t _alignment)
+    {
+#ifdef __cpp_aligned_new
+	if (_alignment > 0)
+	{
+#ifdef __cpp_sized_deallocation
+	    ::operator delete(_ptr, _bytes, std::align_val_t(_alignment));
+#else
+	    ::operator delete(_ptr, std::align_val_t(_alignment));
+#endif
+	    return;
+	}
+#endif
+	(void)_alignment;
+#ifdef __cpp_sized_deallocation
+	::operator delete(_ptr, _bytes);
+#else
+	(void)_bytes; ::operator delete(_ptr);
+#endif
+    }
+    static inline void _operator_delete_n(void* _ptr, std::size_t _bytes, uint32_t _alignment)
+    {
+#ifdef __cpp_aligned_new
+	if (_alignment > 0)
+	{
+#ifdef __cpp_sized_deallocation
+	    ::operator delete[](_ptr, _bytes, std::align_val_t(_alignment));
+#else
+	    ::operator delete[](_ptr, std::align_val_t(_alignment));
+#endif
+	    return;
+	}
+#endif
+	(void)_alignment;
+#ifdef __cpp_sized_deallocation
+	::operator delete[](_ptr, _bytes);
+#else
+	(void)_bytes; ::operator delete[](_ptr);
+#endif
+    }
+
+    // address of the most derived object, i.e. of the allocation
+    template<typename T>
+    static inline void* _allocated_addr(T* _ptr)
+    {
+	if constexpr (std::is_polymorphic<T>::value)
+	    return const_cast<void*>(dynamic_cast<const volatile void*>(_ptr));
+	else
+	    return const_cast<void*>(static_cast<const volatile void*>(_ptr));
+    }
 	
     template<typename T, typename ...Args>
     static inline T* _allocate(const char* _c_file, const char* _c_line, const char* _c_fnc, Args ...args)
     { 
-	T* ptr = new T(args...);
+	memory_budget::charge(AllocType::EXPLICIT, sizeof(T));
+	T* ptr = nullptr;
+	try { ptr = ::new T(args...); }
+	catch (...)
+	{
+	    if (memory_budget::enabled()) memory_budget::credit(AllocType::EXPLICIT, memory_tag::current(), sizeof(T));
+	    throw;
+	}
 	void* void_ptr = reinterpret_cast<void*>(ptr);
 	memory_log::insert(void_ptr, 
 			   sizeof(T), 
 			   malloc_size_func(void_ptr), 
 			   AllocType::EXPLICIT, 
-			   get_caller_signature(_c_file, _c_line, _c_fnc, "new(...)"));
+			   get_caller_signature(_c_file, _c_line, _c_fnc, "new(...)"),
+			   _new_alignment<T>());
 	return ptr;
     }
 	
     template<typename T>
     static inline T* _allocate(const char* _c_file, const char* _c_line, const char* _c_fnc)
     { 
-	T* ptr = new T;
+	memory_budget::charge(AllocType::EXPLICIT, sizeof(T));
+	T* ptr = nullptr;
+	try { ptr = ::new T; }
+	catch (...)
+	{
+	    if (memory_budget::enabled()) memory_budget::credit(AllocType::EXPLICIT, memory_tag::current(), sizeof(T));
+	    throw;
+	}
 	void* void_ptr = reinterpret_cast<void*>(ptr);
 	memory_log::insert(void_ptr, 
 			   sizeof(T), 
 			   malloc_size_func(void_ptr), 
 			   AllocType::EXPLICIT,
-			   get_caller_signature(_c_file, _c_line, _c_fnc, "new()"));
+			   get_caller_signature(_c_file, _c_line, _c_fnc, "new()"),
+			   _new_alignment<T>());
 	if (ptr != nullptr)
 	    return ptr;
 
@@ -478,36 +903,74 @@ namespace Syn {
     template<typename T>
     static inline T* _allocate_n(const char* _c_file, const char* _c_line, const char* _c_fnc, const std::size_t& _n)
     { 
-	T* ptr = new T[_n];
+	/* Allocated as raw storage and constructed in place (the same default-
+	 * initialization as new T[_n]), so there is no array cookie: the pointer
+	 * is the malloc:ed block, and _deallocate_n() knows the element count from
+	 * the recorded bytes, which are 32 bit: larger arrays are rejected.
+	 */
+	if (_n > UINT32_MAX / sizeof(T))
+	    throw std::bad_array_new_length{};
+	constexpr uint32_t alignment = _new_alignment<T>();
+	memory_budget::charge(AllocType::EXPLICIT, sizeof(T) * _n);
+	T* ptr = nullptr;
+	try 
+	{ 
+	    ptr = static_cast<T*>(_operator_new_n(sizeof(T) * _n, alignment));
+	    try { std::uninitialized_default_construct_n(ptr, _n); }
+	    catch (...) { _operator_delete_n(ptr, sizeof(T) * _n, alignment); throw; }
+	}
+	catch (...)
+	{
+	    if (memory_budget::enabled()) memory_budget::credit(AllocType::EXPLICIT, memory_tag::current(), sizeof(T) * _n);
+	    throw;
+	}
 	void* void_ptr = reinterpret_cast<void*>(ptr);
 	memory_log::insert(void_ptr, 
 			   sizeof(T) * _n, 
 			   malloc_size_func(void_ptr), 
 			   AllocType::EXPLICIT,
-			   get_caller_signature(_c_file, _c_line, _c_fnc, "new[]"));
+			   get_caller_signature(_c_file, _c_line, _c_fnc, "new[]"),
+			   alignment);
 	if (ptr != nullptr)
 	    return ptr;
 
 	throw std::bad_alloc{};
     }
 
-    static inline void _deallocate(void *_ptr)
+    /* Typed deallocation: destroys the object(s) and frees the memory with sized
+     * (and, if over-aligned, aligned) deallocation, using the recorded bytes and
+     * alignment. Deleting through a base class with a virtual destructor is
+     * correct also for a non-primary base, as the allocation is looked up at the
+     * address of the most derived object.
+     */
+    template<typename T>
+    static inline void _deallocate(T* _ptr)
     {
-	memory_log::remove(_ptr, memory_log::get_alloc_bytes(_ptr), malloc_size_func(_ptr), AllocType::EXPLICIT);
-	::operator delete(_ptr);
+	if (_ptr == nullptr)
+	    return;
+	void* addr = _allocated_addr(_ptr);
+	uint32_t alignment = 0;
+	uint32_t bytes = memory_log::release(addr, AllocType::EXPLICIT, &alignment);
+	_ptr->~T();
+	_operator_delete(addr, bytes, alignment);
     }
 
-    static inline void _deallocate_n(void *_ptr)
+    template<typename T>
+    static inline void _deallocate_n(T* _ptr)
     {
-	memory_log::remove(_ptr, memory_log::get_alloc_bytes(_ptr), malloc_size_func(_ptr), AllocType::EXPLICIT);
-	::operator delete[](_ptr); 
+	if (_ptr == nullptr)
+	    return;
+	uint32_t alignment = 0;
+	uint32_t bytes = memory_log::release(reinterpret_cast<void*>(_ptr), AllocType::EXPLICIT, &alignment);
+	std::destroy_n(_ptr, bytes / sizeof(T));
+	_operator_delete_n(reinterpret_cast<void*>(_ptr), bytes, alignment);
     }
 #else
     template<typename T, typename ...Args> static inline T* allocate(Args ...args) { return new T(args...); }
     template<typename T> static inline T* allocate() { return new T; }
     template<typename T> static inline T* allocate_n(const std::size_t& _n) {  return new T[_n]; }
-    static inline void deallocate(void *_ptr) { delete _ptr; }
-    static inline void deallocate_n(void *_ptr) { delete[] _ptr; }
+    template<typename T> static inline void deallocate(T* _ptr) { delete _ptr; }
+    template<typename T> static inline void deallocate_n(T* _ptr) { delete[] _ptr; }
 #endif
 
 
@@ -550,13 +1013,23 @@ namespace Syn {
 #define SYN_NEW_N(T, ...) 		 Syn::_allocate_n<T>(__FILE__, TOSTR(__LINE__), FUNCSIG, ##__VA_ARGS__)
 #define SYN_DELETE(mem_addr)             Syn::_deallocate(mem_addr);
 #define SYN_DELETE_N(mem_addr)           Syn::_deallocate_n(mem_addr)
-// #define SYN_DEALLOCATE(mem_addr)   Syn::_deallocate<decltype(mem_addr)>(mem_addr);
-// #define SYN_DEALLOCATE_N(mem_addr) Syn::_deallocate_n<decltype(mem_addr)>(mem_addr)
 #else
 #define SYN_NEW(T, ...) 		  new T(__VA_ARGS__)
 #define SYN_NEW_N(T, n) 		  new T[n]
-#define SYN_DELETE(mem_addr)              ::operator delete(mem_addr);
-#define SYN_DELETE_N(mem_addr)            ::operator delete[](mem_addr)
+#define SYN_DELETE(mem_addr)              delete mem_addr;
+#define SYN_DELETE_N(mem_addr)            delete[] mem_addr
+#endif
+
+// macro for charging allocations in the enclosing scope to a memory_tag
+//
+#define SYN_CONCAT_(a, b) a##b
+#define SYN_CONCAT(a, b) SYN_CONCAT_(a, b)
+#ifdef DEBUG_MEMORY_ALLOC
+#define SYN_MEMORY_SCOPE(name) \
+    static const uint16_t SYN_CONCAT(_syn_tag_, __LINE__) = Syn::memory_tag::get(name); \
+    Syn::MemoryScope SYN_CONCAT(_syn_scope_, __LINE__)(SYN_CONCAT(_syn_tag_, __LINE__))
+#else
+#define SYN_MEMORY_SCOPE(name)
 #endif
 
 // macros for creating a alloc-tracked std::shared_ptr
@@ -0,0 +1,325 @@
+
+#include "syn_leak_scan.h"
+
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <setjmp.h>		// setjmp(), to spill the registers to the stack
+#include <stdio.h>		// sscanf()
+#ifdef __linux__
+#include <link.h>		// dl_iterate_phdr()
+#endif
+
+
+namespace Syn {
+
+    // an address range [m_begin, m_end)
+    struct scan_range
+    {
+	uintptr_t m_begin;
+	uintptr_t m_end;
+    };
+
+    // the tracked blocks, sorted on address, and their marks
+    struct scan_blocks
+    {
+	std::vector<uintptr_t> m_begin;
+	std::vector<uintptr_t> m_end;
+	std::unique_ptr<std::atomic<uint8_t>[]> m_marks;
+	uintptr_t m_lo = 0;
+	uintptr_t m_hi = 0;
+    };
+
+    // newly marked blocks of a thread beyond this are split between the threads
+    static constexpr size_t SCAN_SPILL = 4096;
+
+
+    //-----------------------------------------------------------------------------------
+    // Mark the blocks pointed to from the words of [_begin, _end), pushing the newly marked.
+    static void scan_words(scan_blocks& _blocks, uintptr_t _begin, uintptr_t _end, std::vector<uint32_t>& _stack)
+    {
+	const uintptr_t* p = (const uintptr_t*)((_begin + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1));
+	const uintptr_t* end = (const uintptr_t*)(_end & ~(sizeof(uintptr_t) - 1));
+	for (; p < end; p++)
+	{
+	    uintptr_t v = *p;
+	    if (v < _blocks.m_lo || v >= _blocks.m_hi)
+		continue;
+	    // the last block starting at or below v (there is one, as v >= m_lo)
+	    auto it = std::upper_bound(_blocks.m_begin.begin(), _blocks.m_begin.end(), v);
+	    uint32_t b = (uint32_t)(it - _blocks.m_begin.begin()) - 1;
+	    if (v >= _blocks.m_end[b])
+		continue;
+	    if (_blocks.m_marks[b].load(std::memory_order_relaxed) == 0 && _blocks.m_marks[b].exchange(1) == 0)
+		_stack.push_back(b);
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    // Scan the marked blocks of _stack, and the blocks found in them, depth first.
+    static void drain_blocks(scan_blocks& _blocks, std::vector<uint32_t>& _stack, std::vector<uint32_t>& _spill)
+    {
+	while (!_stack.empty())
+	{
+	    uint32_t b = _stack.back();
+	    _stack.pop_back();
+	    scan_words(_blocks, _blocks.m_begin[b], _blocks.m_end[b], _stack);
+	    if (_stack.size() > SCAN_SPILL)
+	    {
+		size_t half = _stack.size() / 2;
+		_spill.insert(_spill.end(), _stack.begin(), _stack.begin() + half);
+		_stack.erase(_stack.begin(), _stack.begin() + half);
+	    }
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    /* Writable file-backed mappings (data), the anonymous mappings directly
+     * following them (bss), the main stack and the registered thread stacks. The
+     * stack of the calling thread is scanned from _sp up.
+     */
+    static std::vector<scan_range> collect_roots(uintptr_t _sp)
+    {
+	std::vector<scan_range> roots;
+#ifdef __linux__
+	/* Data and bss are the writable PT_LOAD segments of the loaded objects,
+	 * and not any writable file mapping, which may be a MAP_SHARED data file
+	 * (that faults if truncated), a shared memory segment or a device.
+	 */
+	dl_iterate_phdr([](struct dl_phdr_info* _info, size_t, void* _roots)
+	{
+	    for (int i = 0; i < _info->dlpi_phnum; i++)
+	    {
+		const ElfW(Phdr)& phdr = _info->dlpi_phdr[i];
+		if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_W) || phdr.p_memsz == 0)
+		    continue;
+		uintptr_t begin = (uintptr_t)(_info->dlpi_addr + phdr.p_vaddr);
+		((std::vector<scan_range>*)_roots)->push_back({ begin, begin + phdr.p_memsz });
+	    }
+	    return 0;
+	}, &roots);
+
+	std::ifstream maps("/proc/self/maps");
+	std::string line;
+	while (std::getline(maps, line))
+	{
+	    unsigned long begin = 0, end = 0;
+	    char perms[5] = { 0 };
+	    int path_pos = 0;
+	    if (sscanf(line.c_str(), "%lx-%lx %4s %*x %*x:%*x %*u %n", &begin, &end, perms, &path_pos) < 3)
+		continue;
+	    std::string path = path_pos > 0 ? line.substr(path_pos) : "";
+	    if (path == "[stack]" && perms[3] != 's')
+		roots.push_back({ _sp >= begin && _sp < end ? _sp : begin, end });
+	}
+	for (auto& stack : memory_thread::get_stacks())
+	    roots.push_back({ _sp >= stack.m_begin && _sp < stack.m_end ? _sp : stack.m_begin, stack.m_end });
+#else
+	(void)_sp;
+#endif
+	return roots;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    leak_scan_result leak_scan::scan(unsigned _threads)
+    {
+	/* Spill the registers of the calling thread into this frame, which is above
+	 * the frame of _scan(), where the stack scan starts.
+	 */
+	jmp_buf registers;
+	setjmp(registers);
+	return _scan(_threads);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    __attribute__((noinline)) leak_scan_result leak_scan::_scan(unsigned _threads)
+    {
+	auto start = std::chrono::steady_clock::now();
+	uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+
+	leak_scan_result result;
+	result.m_threads = _threads > 0 ? _threads : std::max(1u, std::thread::hardware_concurrency());
+	unsigned threads = result.m_threads;
+
+	std::lock_guard<std::mutex> lock(memory_log::s_mutex);
+
+	// the live tracked blocks, sorted on address
+	std::vector<std::pair<uintptr_t, const std::pair<void* const, memory_alloc_info>*>> live;
+	for (auto& it : memory_log::s_memory)
+	    if (!it.second.is_deallocated())
+		live.push_back({ (uintptr_t)it.first, &it });
+	std::sort(live.begin(), live.end(),
+		  [](const std::pair<uintptr_t, const std::pair<void* const, memory_alloc_info>*>& _a,
+		     const std::pair<uintptr_t, const std::pair<void* const, memory_alloc_info>*>& _b) { return _a.first < _b.first; });
+
+	scan_blocks blocks;
+	blocks.m_begin.reserve(live.size());
+	blocks.m_end.reserve(live.size());
+	for (auto& it : live)
+	{
+	    blocks.m_begin.push_back(it.first);
+	    blocks.m_end.push_back(it.first + std::max<uint32_t>(it.second->second.m_allocBytes, 1));
+	}
+	blocks.m_marks.reset(new std::atomic<uint8_t>[live.size()]());
+	if (!live.empty())
+	{
+	    blocks.m_lo = blocks.m_begin.front();
+	    blocks.m_hi = *std::max_element(blocks.m_end.begin(), blocks.m_end.end());
+	}
+
+	// split the roots between the threads in address ranges of equal size
+	std::vector<scan_range> roots = collect_roots(sp);
+	std::sort(roots.begin(), roots.end(), [](const scan_range& _a, const scan_range& _b) { return _a.m_begin < _b.m_begin; });
+	for (auto& root : roots)
+	    result.m_rootBytes += root.m_end - root.m_begin;
+	uint64_t part_bytes = (result.m_rootBytes / threads / sizeof(uintptr_t) + 1) * sizeof(uintptr_t);
+	std::vector<std::vector<scan_range>> parts(threads);
+	unsigned part = 0;
+	uint64_t filled = 0;
+	for (scan_range root : roots)
+	{
+	    while (root.m_begin < root.m_end)
+	    {
+		uintptr_t end = part + 1 < threads ? std::min<uintptr_t>(root.m_end, root.m_begin + (part_bytes - filled)) : root.m_end;
+		parts[part].push_back({ root.m_begin, end });
+		filled += end - root.m_begin;
+		root.m_begin = end;
+		if (filled >= part_bytes && part + 1 < threads)
+		{
+		    part++;
+		    filled = 0;
+		}
+	    }
+	}
+
+	std::vector<std::vector<uint32_t>> spills(threads);
+	auto run = [threads](const std::function<void(unsigned)>& _fnc)
+	{
+	    std::vector<std::thread> workers;
+	    for (unsigned t = 0; t < threads; t++)
+		workers.emplace_back(_fnc, t);
+	    for (auto& w : workers)
+		w.join();
+	};
+
+	// mark from the roots; then, until no thread has spilled blocks, split the
+	// spilled blocks between the threads by address and continue from them
+	run([&](unsigned _t)
+	{
+	    std::vector<uint32_t> stack;
+	    for (auto& range : parts[_t])
+	    {
+		scan_words(blocks, range.m_begin, range.m_end, stack);
+		drain_blocks(blocks, stack, spills[_t]);
+	    }
+	});
+	std::vector<uint32_t> frontier;
+	for (;;)
+	{
+	    frontier.clear();
+	    for (auto& spill : spills)
+	    {
+		frontier.insert(frontier.end(), spill.begin(), spill.end());
+		spill.clear();
+	    }
+	    if (frontier.empty())
+		break;
+	    std::sort(frontier.begin(), frontier.end());
+	    run([&](unsigned _t)
+	    {
+		std::vector<uint32_t> stack(frontier.begin() + frontier.size() * _t / threads,
+					    frontier.begin() + frontier.size() * (_t + 1) / threads);
+		drain_blocks(blocks, stack, spills[_t]);
+	    });
+	}
+
+	result.m_records.reserve(live.size());
+	for (size_t b = 0; b < live.size(); b++)
+	{
+	    const memory_alloc_info& info = live[b].second->second;
+	    bool reachable = blocks.m_marks[b].load() != 0;
+	    result.m_records.push_back({ live[b].second->first, info.m_allocBytes, info.m_allocType,
+					 info.m_tag, info.m_allocThread, reachable, info.m_callerFnc });
+	    if (reachable)
+	    {
+		result.m_reachableCount++;
+		result.m_reachableBytes += info.m_allocBytes;
+	    }
+	    else
+	    {
+		result.m_lostCount++;
+		result.m_lostBytes += info.m_allocBytes;
+	    }
+	}
+	result.m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string leak_scan::print(const leak_scan_result& _result, bool _include_reachable)
+    {
+	struct site_leaks
+	{
+	    std::string m_callerFnc;
+	    uint32_t m_lostCount = 0;
+	    uint64_t m_lostBytes = 0;
+	    uint32_t m_reachableCount = 0;
+	    uint64_t m_reachableBytes = 0;
+	};
+	std::unordered_map<std::string, site_leaks> sites;
+	for (auto& record : _result.m_records)
+	{
+	    site_leaks& site = sites[record.m_callerFnc];
+	    site.m_callerFnc = record.m_callerFnc;
+	    if (record.m_reachable)
+	    {
+		site.m_reachableCount++;
+		site.m_reachableBytes += record.m_allocBytes;
+	    }
+	    else
+	    {
+		site.m_lostCount++;
+		site.m_lostBytes += record.m_allocBytes;
+	    }
+	}
+	std::vector<const site_leaks*> ranked;
+	for (auto& it : sites)
+	    if (_include_reachable || it.second.m_lostCount > 0)
+		ranked.push_back(&it.second);
+	std::sort(ranked.begin(), ranked.end(),
+		  [](const site_leaks* _a, const site_leaks* _b) { return _a->m_lostBytes > _b->m_lostBytes; });
+
+	std::ostringstream ss;
+	ss << "LEAK SCAN: " << _result.m_records.size() << " live allocations, ";
+	ss << _result.m_lostCount << " lost (" << memory_log::_fmt_sz(_result.m_lostBytes) << "), ";
+	ss << _result.m_reachableCount << " reachable (" << memory_log::_fmt_sz(_result.m_reachableBytes) << ").\n";
+	ss << "(" << memory_log::_fmt_sz(_result.m_rootBytes) << " of roots scanned by " << _result.m_threads << " thread(s) in ";
+	ss << std::fixed << std::setprecision(1) << _result.m_seconds * 1000.0 << " ms.)\n";
+	ss << std::setw(4) << "";
+	ss << std::setw(73) << std::right << "CALLING FUNCTION";
+	ss << std::setw(8) << std::right << "LOST";
+	ss << std::setw(14) << std::right << "LOST BYTES";
+	ss << std::setw(12) << std::right << "REACHABLE";
+	ss << std::setw(18) << std::right << "REACHABLE BYTES" << "\n";
+	for (auto site : ranked)
+	{
+	    ss << std::setw(4) << "";
+	    ss << std::right << std::setw(73) << site->m_callerFnc + (site->m_callerFnc == "" ? "(no caller function specified)" : "");
+	    ss << std::right << std::setw(8) << site->m_lostCount;
+	    ss << std::right << std::setw(14) << memory_log::_fmt_sz(site->m_lostBytes);
+	    ss << std::right << std::setw(12) << site->m_reachableCount;
+	    ss << std::right << std::setw(18) << memory_log::_fmt_sz(site->m_reachableBytes) << "\n";
+	}
+	return ss.str();
+    }
+
+
+}
+
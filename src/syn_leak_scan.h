@@ -0,0 +1,76 @@
+#ifndef __SYN_LEAK_SCAN_H
+#define __SYN_LEAK_SCAN_H
+
+#include "syn_allocator.h"
+
+
+namespace Syn {
+
+    /*
+     * A live allocation, as classified by leak_scan.
+     */
+    struct leak_record
+    {
+	void* m_addr;
+	uint32_t m_allocBytes;
+	AllocType m_allocType;
+	uint16_t m_tag;
+	uint16_t m_allocThread;
+	bool m_reachable;
+	std::string m_callerFnc;
+    };
+
+    struct leak_scan_result
+    {
+	std::vector<leak_record> m_records;	// live allocations, by address
+	uint32_t m_reachableCount = 0;
+	uint64_t m_reachableBytes = 0;
+	uint32_t m_lostCount = 0;
+	uint64_t m_lostBytes = 0;
+	uint64_t m_rootBytes = 0;		// bytes of roots scanned
+	unsigned m_threads = 0;
+	double m_seconds = 0.0;
+    };
+
+
+    /*
+     * Conservative reachability scan, classifying every live tracked allocation
+     * as reachable or (definitely) lost, e.g. at exit:
+     *	    std::cout << Syn::leak_scan::print(Syn::leak_scan::scan());
+     *
+     * The roots are the writable data and bss segments of the executable and the
+     * shared libraries (their writable PT_LOAD segments), the stack of the main thread, the
+     * stacks of the threads registered by memory_thread and the registers of the
+     * calling thread. Every word of the roots, and then of every reachable block,
+     * is taken as a pointer if it points into a tracked block (interior pointers
+     * included). The words are split across _threads threads by address range (0
+     * for one per core); chains of blocks are followed by the thread finding them,
+     * and large sets of newly found blocks are split again between the threads.
+     *
+     * Being conservative, an integer that happens to look like a pointer keeps a
+     * block reachable. Conversely, untracked heap memory (plain new/malloc) is not
+     * scanned, so a block only reachable through untracked heap objects is reported
+     * as lost, as are the stacks of threads that never touched tracked memory and
+     * the thread-local storage of the main thread. Blocks only reachable from lost
+     * blocks are lost. The scan holds the record lock and reads memory that other
+     * threads may modify, so it should be run with the other threads quiescent.
+     * Linux only.
+     */
+    class leak_scan
+    {
+    public:
+	static leak_scan_result scan(unsigned _threads=0);
+	// Print the call sites with lost allocations (or all live ones), by lost bytes.
+	static std::string print(const leak_scan_result& _result, bool _include_reachable=false);
+
+    private:
+	// the scan proper, scanning the stack of the calling thread from its own frame up
+	static leak_scan_result _scan(unsigned _threads);
+    };
+
+
+} // namespace Syn
+
+
+#endif // __SYN_LEAK_SCAN_H
+
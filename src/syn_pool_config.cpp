@@ -0,0 +1,403 @@
+
+#include "syn_pool_config.h"
+
+#include <fstream>
+#include <algorithm>
+
+
+namespace Syn {
+
+    //-----------------------------------------------------------------------------------
+    bool pool_config::generate(const std::string& _trace_path, pool_config& _config, double _coverage, double _max_slack)
+    {
+	std::ifstream in(_trace_path);
+	if (!in)
+	{
+	    SYN_CORE_WARNING("pool_config: could not open trace '" << _trace_path << "'.");
+	    return false;
+	}
+
+	/* First pass: request size histogram, per call site counts, and the
+	 * sequence of live size changes for the peak live blocks per size class.
+	 */
+	struct site_profile
+	{
+	    pool_site_config m_config;
+	    std::vector<uint32_t> m_sizes;
+	};
+	std::unordered_map<uint32_t, site_profile> sites;
+	std::map<uint32_t, uint64_t> histogram;
+	std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> live;	// address -> (site, bytes)
+	std::vector<int64_t> sequence;						// +bytes allocated, -bytes freed
+	uint64_t allocs = 0;
+
+	std::string line;
+	while (std::getline(in, line))
+	{
+	    if (line.empty() || line[0] == '#')
+		continue;
+	    std::istringstream ss(line);
+	    char op;
+	    ss >> op;
+	    if (op == 's')
+	    {
+		uint32_t site = 0;
+		ss >> site;
+		ss.get();	// the separating space
+		std::getline(ss, sites[site].m_config.m_callerFnc);
+		continue;
+	    }
+	    unsigned thread;
+	    std::string addr;
+	    if (!(ss >> thread >> addr))
+		continue;
+	    if (op == 'a')
+	    {
+		uint32_t bytes = 0, site = 0;
+		ss >> bytes >> site;
+		site_profile& p = sites[site];
+		p.m_config.m_allocs++;
+		p.m_config.m_maxBytes = std::max(p.m_config.m_maxBytes, bytes);
+		p.m_sizes.push_back(bytes);
+		histogram[bytes]++;
+		live[addr] = { site, bytes };
+		sequence.push_back(bytes);
+		allocs++;
+	    }
+	    else if (op == 'f')
+	    {
+		auto it = live.find(addr);
+		if (it == live.end())
+		    continue;
+		sites[it->second.first].m_config.m_deallocs++;
+		sequence.push_back(-(int64_t)it->second.second);
+		live.erase(it);
+	    }
+	}
+	if (allocs == 0)
+	{
+	    SYN_CORE_WARNING("pool_config: no allocations in trace '" << _trace_path << "'.");
+	    return false;
+	}
+
+	// the smallest request size covering _coverage of the allocations
+	uint32_t cover_size = histogram.rbegin()->first;
+	uint64_t cumulative = 0;
+	for (auto& it : histogram)
+	{
+	    cumulative += it.second;
+	    if ((double)cumulative >= _coverage * (double)allocs)
+	    {
+		cover_size = it.first;
+		break;
+	    }
+	}
+
+	/* Size classes: grow a class over consecutive request sizes for as long
+	 * as the smallest of them, rounded up to the class, wastes at most
+	 * _max_slack of the class. Classes are 8 byte aligned.
+	 */
+	auto align = [](uint32_t _bytes) { return (_bytes + 7) & ~7u; };
+	std::vector<uint32_t> classes;
+	uint32_t lo = 0, hi = 0;
+	for (auto& it : histogram)
+	{
+	    uint32_t size = it.first;
+	    if (size > cover_size)
+		break;
+	    if (hi > 0 && (double)(align(size) - lo) > _max_slack * (double)align(size))
+	    {
+		if (classes.empty() || classes.back() < align(hi))
+		    classes.push_back(align(hi));
+		lo = size;
+	    }
+	    if (hi == 0)
+		lo = size;
+	    hi = size;
+	}
+	if (hi > 0 && (classes.empty() || classes.back() < align(hi)))
+	    classes.push_back(align(hi));
+
+	// peak number of live blocks per size class, and of any, for max_blocks_per_chunk
+	std::vector<int64_t> live_blocks(classes.size(), 0);
+	std::vector<int64_t> peak_class_blocks(classes.size(), 0);
+	int64_t peak_blocks = 0;
+	for (int64_t change : sequence)
+	{
+	    uint32_t bytes = (uint32_t)(change > 0 ? change : -change);
+	    auto c = std::lower_bound(classes.begin(), classes.end(), bytes);
+	    if (c == classes.end())
+		continue;
+	    int64_t& blocks = live_blocks[c - classes.begin()];
+	    blocks += change > 0 ? 1 : -1;
+	    int64_t& peak = peak_class_blocks[c - classes.begin()];
+	    peak = std::max(peak, blocks);
+	    peak_blocks = std::max(peak_blocks, blocks);
+	}
+
+	_config = pool_config();
+	_config.m_coverage = _coverage;
+	_config.m_maxSlack = _max_slack;
+	_config.m_sizeClasses = classes;
+	for (int64_t peak : peak_class_blocks)
+	    _config.m_sizeClassBlocks.push_back((uint32_t)std::min<int64_t>(std::max<int64_t>(peak, 1), 4096));
+	_config.m_options.largest_required_pool_block = classes.empty() ? 0 : classes.back();
+	_config.m_options.max_blocks_per_chunk = std::min<int64_t>(std::max<int64_t>(peak_blocks, 16), 4096);
+
+	/* Per call site: rarely freed allocations go to a monotonic arena, frequent
+	 * ones fitting the pools (in 95% of the cases) to a pool, the rest to the heap.
+	 */
+	for (auto& it : sites)
+	{
+	    site_profile& p = it.second;
+	    if (p.m_config.m_allocs == 0)
+		continue;
+	    size_t fit = std::count_if(p.m_sizes.begin(), p.m_sizes.end(),
+				       [&](uint32_t _bytes) { return _bytes <= _config.m_options.largest_required_pool_block; });
+	    double freed = (double)p.m_config.m_deallocs / (double)p.m_config.m_allocs;
+	    if (freed < 0.1)
+		p.m_config.m_strategy = PoolStrategy::MONOTONIC;
+	    else if (p.m_config.m_allocs >= 16 && (double)fit >= 0.95 * (double)p.m_sizes.size())
+		p.m_config.m_strategy = PoolStrategy::POOL;
+	    else
+		p.m_config.m_strategy = PoolStrategy::HEAP;
+	    _config.m_sites.push_back(p.m_config);
+	}
+	std::sort(_config.m_sites.begin(), _config.m_sites.end(),
+		  [](const pool_site_config& _a, const pool_site_config& _b) { return _a.m_allocs > _b.m_allocs; });
+
+	return true;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    bool pool_config::write(const std::string& _path) const
+    {
+	std::ofstream out(_path);
+	if (!out)
+	{
+	    SYN_CORE_WARNING("pool_config: could not write '" << _path << "'.");
+	    return false;
+	}
+	out << "# syn pool config\n";
+	out << "coverage " << m_coverage << "\n";
+	out << "max_slack " << m_maxSlack << "\n";
+	out << "largest_required_pool_block " << m_options.largest_required_pool_block << "\n";
+	out << "max_blocks_per_chunk " << m_options.max_blocks_per_chunk << "\n";
+	out << "size_classes";
+	for (auto c : m_sizeClasses)
+	    out << " " << c;
+	out << "\n";
+	out << "size_class_blocks";
+	for (auto b : m_sizeClassBlocks)
+	    out << " " << b;
+	out << "\n";
+	out << "# site <strategy> <allocs> <deallocs> <max bytes> <caller>\n";
+	for (auto& site : m_sites)
+	{
+	    out << "site " << PoolStrategyStr(site.m_strategy) << " " << site.m_allocs << " " << site.m_deallocs << " ";
+	    out << site.m_maxBytes << " " << site.m_callerFnc << "\n";
+	}
+	return true;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    bool pool_config::load(const std::string& _path, pool_config& _config)
+    {
+	std::ifstream in(_path);
+	if (!in)
+	{
+	    SYN_CORE_WARNING("pool_config: could not open '" << _path << "'.");
+	    return false;
+	}
+	_config = pool_config();
+	std::string line;
+	while (std::getline(in, line))
+	{
+	    if (line.empty() || line[0] == '#')
+		continue;
+	    std::istringstream ss(line);
+	    std::string key;
+	    ss >> key;
+	    if (key == "coverage")				ss >> _config.m_coverage;
+	    else if (key == "max_slack")			ss >> _config.m_maxSlack;
+	    else if (key == "largest_required_pool_block")	ss >> _config.m_options.largest_required_pool_block;
+	    else if (key == "max_blocks_per_chunk")		ss >> _config.m_options.max_blocks_per_chunk;
+	    else if (key == "size_classes")
+	    {
+		uint32_t c;
+		while (ss >> c)
+		    _config.m_sizeClasses.push_back(c);
+	    }
+	    else if (key == "size_class_blocks")
+	    {
+		uint32_t b;
+		while (ss >> b)
+		    _config.m_sizeClassBlocks.push_back(b);
+	    }
+	    else if (key == "site")
+	    {
+		pool_site_config site;
+		std::string strategy;
+		ss >> strategy >> site.m_allocs >> site.m_deallocs >> site.m_maxBytes;
+		ss.get();	// the separating space
+		std::getline(ss, site.m_callerFnc);
+		if (strategy == "pool")		  site.m_strategy = PoolStrategy::POOL;
+		else if (strategy == "monotonic") site.m_strategy = PoolStrategy::MONOTONIC;
+		else				  site.m_strategy = PoolStrategy::HEAP;
+		_config.m_sites.push_back(site);
+	    }
+	    else
+		SYN_CORE_WARNING("pool_config: unknown entry '" << key << "' in '" << _path << "'.");
+	}
+	return true;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    std::string pool_config::print() const
+    {
+	std::ostringstream ss;
+	ss << "POOL CONFIGURATION (" << m_coverage * 100.0 << "% coverage, " << m_maxSlack * 100.0 << "% max slack)\n";
+	ss << "largest_required_pool_block: " << m_options.largest_required_pool_block << "\n";
+	ss << "max_blocks_per_chunk:        " << m_options.max_blocks_per_chunk << "\n";
+	ss << "size classes:               ";
+	for (auto c : m_sizeClasses)
+	    ss << " " << c;
+	ss << "\n";
+	ss << "size class blocks:          ";
+	for (auto b : m_sizeClassBlocks)
+	    ss << " " << b;
+	ss << "\n";
+	ss << std::setw(4) << "";
+	ss << std::setw(73) << std::right << "CALLING FUNCTION";
+	ss << std::setw(12) << std::right << "STRATEGY";
+	ss << std::setw(10) << std::right << "ALLOCS";
+	ss << std::setw(10) << std::right << "FREES";
+	ss << std::setw(12) << std::right << "MAX BYTES" << "\n";
+	for (auto& site : m_sites)
+	{
+	    ss << std::setw(4) << "";
+	    ss << std::setw(73) << std::right << site.m_callerFnc;
+	    ss << std::setw(12) << std::right << PoolStrategyStr(site.m_strategy);
+	    ss << std::setw(10) << std::right << site.m_allocs;
+	    ss << std::setw(10) << std::right << site.m_deallocs;
+	    ss << std::setw(12) << std::right << site.m_maxBytes << "\n";
+	}
+	return ss.str();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    PoolStrategy pool_config::get_strategy(const std::string& _caller_fnc) const
+    {
+	auto it = std::find_if(m_sites.begin(), m_sites.end(),
+			       [&](const pool_site_config& _site) { return _site.m_callerFnc == _caller_fnc; });
+	return it != m_sites.end() ? it->m_strategy : PoolStrategy::HEAP;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    SizeClassPoolResource::SizeClassPoolResource(const pool_config& _config, std::pmr::memory_resource* _upstream) :
+	m_upstream(_upstream)
+    {
+	/* A block holds the free list link, and is a multiple of its alignment,
+	 * the largest power of two dividing its size (up to max_align_t), as the
+	 * chunks are max_align_t aligned.
+	 */
+	static constexpr size_t MIN_CHUNK_BYTES = 4096;
+	static constexpr size_t MAX_CHUNK_BYTES = 1024 * 1024;
+	std::vector<std::pair<uint32_t, size_t>> classes;	// (bytes, peak live blocks)
+	for (size_t i = 0; i < _config.m_sizeClasses.size(); i++)
+	{
+	    size_t blocks = i < _config.m_sizeClassBlocks.size() ? _config.m_sizeClassBlocks[i] : _config.m_options.max_blocks_per_chunk;
+	    classes.push_back({ _config.m_sizeClasses[i], std::max<size_t>(blocks, 1) });
+	}
+	std::sort(classes.begin(), classes.end());
+	for (auto& it : classes)
+	{
+	    size_t block = std::max<size_t>(it.first, sizeof(void*));
+	    block = (block + alignof(void*) - 1) & ~(alignof(void*) - 1);
+	    if (!m_classes.empty() && m_classes.back()->m_blockBytes >= block)
+		continue;
+	    m_classes.emplace_back(new size_class);
+	    size_class& c = *m_classes.back();
+	    c.m_blockBytes = block;
+	    c.m_alignment = std::min<size_t>(block & (~block + 1), alignof(std::max_align_t));
+	    c.m_maxChunkBlocks = std::max<size_t>(std::min(it.second, MAX_CHUNK_BYTES / block), 1);
+	    c.m_chunkBlocks = std::min(std::max<size_t>(MIN_CHUNK_BYTES / block, 1), c.m_maxChunkBlocks);
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void SizeClassPoolResource::release()
+    {
+	for (auto& c : m_classes)
+	{
+	    std::lock_guard<std::mutex> lock(c->m_mutex);
+	    for (auto& chunk : c->m_chunks)
+		m_upstream->deallocate(chunk.first, chunk.second, alignof(std::max_align_t));
+	    c->m_chunks.clear();
+	    c->m_free = nullptr;
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    SizeClassPoolResource::size_class* SizeClassPoolResource::_find(size_t _bytes, size_t _alignment)
+    {
+	// (same answer for an allocation and its deallocation)
+	auto it = std::lower_bound(m_classes.begin(), m_classes.end(), _bytes,
+				   [](const std::unique_ptr<size_class>& _c, size_t _b) { return _c->m_blockBytes < _b; });
+	if (it == m_classes.end() || _alignment > (*it)->m_alignment)
+	    return nullptr;
+	return it->get();
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void* SizeClassPoolResource::do_allocate(std::size_t _bytes, std::size_t _alignment)
+    {
+	size_class* c = _find(_bytes, _alignment);
+	if (c == nullptr)
+	    return m_upstream->allocate(_bytes, _alignment);
+
+	std::lock_guard<std::mutex> lock(c->m_mutex);
+	if (c->m_free == nullptr)
+	{
+	    size_t blocks = c->m_chunkBlocks;
+	    char* chunk = (char*)m_upstream->allocate(c->m_blockBytes * blocks, alignof(std::max_align_t));
+	    c->m_chunks.push_back({ chunk, c->m_blockBytes * blocks });
+	    c->m_chunkBlocks = std::min(blocks * 2, c->m_maxChunkBlocks);
+	    for (size_t i = blocks; i-- > 0; )
+	    {
+		void* block = chunk + i * c->m_blockBytes;
+		*(void**)block = c->m_free;
+		c->m_free = block;
+	    }
+	}
+	void* block = c->m_free;
+	c->m_free = *(void**)block;
+	return block;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void SizeClassPoolResource::do_deallocate(void* _ptr, std::size_t _bytes, std::size_t _alignment)
+    {
+	size_class* c = _find(_bytes, _alignment);
+	if (c == nullptr)
+	{
+	    m_upstream->deallocate(_ptr, _bytes, _alignment);
+	    return;
+	}
+	std::lock_guard<std::mutex> lock(c->m_mutex);
+	*(void**)_ptr = c->m_free;
+	c->m_free = _ptr;
+    }
+
+
+}
+
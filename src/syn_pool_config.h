@@ -0,0 +1,156 @@
+#ifndef __SYN_POOL_CONFIG_H
+#define __SYN_POOL_CONFIG_H
+
+#include "syn_allocator.h"
+
+
+namespace Syn {
+
+    //
+    enum class PoolStrategy
+    {
+	HEAP	  = 0,
+	POOL	  = 1,
+	MONOTONIC = 2
+    };
+
+    static inline std::string PoolStrategyStr(PoolStrategy _strategy)
+    {
+	switch (_strategy)
+	{
+	case PoolStrategy::HEAP:	return "heap";
+	case PoolStrategy::POOL:	return "pool";
+	case PoolStrategy::MONOTONIC:	return "monotonic";
+	}
+	return "heap";
+    }
+
+
+    /*
+     * Recommended allocation strategy of a call site, with the profile it is
+     * based on.
+     */
+    struct pool_site_config
+    {
+	std::string m_callerFnc;
+	PoolStrategy m_strategy = PoolStrategy::HEAP;
+	uint32_t m_allocs = 0;
+	uint32_t m_deallocs = 0;
+	uint32_t m_maxBytes = 0;
+    };
+
+
+    /*
+     * Profile-guided pool configuration, generated from an allocation trace
+     * (memory_log::start_trace()):
+     *  - size classes, each bounding the slack of the requests rounded up to it
+     *    to m_maxSlack, the largest one covering m_coverage of all allocations;
+     *  - per size class, its peak number of live blocks, which bounds the
+     *    chunks of the class;
+     *  - std::pmr::pool_options, with the largest size class as the largest
+     *    required pool block and max blocks per chunk from the largest peak
+     *    number of live blocks of a size class;
+     *  - per call site, a monotonic arena (allocations that are rarely freed), a
+     *    pool (frequent allocations that fit the pools) or the heap.
+     * The configuration is written and loaded as text, so that it can be loaded
+     * at startup and a tracked pool resource built from it (the size classes
+     * are only used by SizeClassPoolResource, a std::pmr pool resource only
+     * takes the pool_options).
+     */
+    class pool_config
+    {
+    public:
+	// Generate from the trace at _trace_path.
+	static bool generate(const std::string& _trace_path,
+			     pool_config& _config,
+			     double _coverage=0.95,
+			     double _max_slack=0.25);
+	static bool load(const std::string& _path, pool_config& _config);
+	bool write(const std::string& _path) const;
+	std::string print() const;
+
+	// Strategy of call site _caller_fnc (heap if not in the profile).
+	PoolStrategy get_strategy(const std::string& _caller_fnc) const;
+
+    public:
+	double m_coverage = 0.95;
+	double m_maxSlack = 0.25;
+	std::pmr::pool_options m_options;
+	std::vector<uint32_t> m_sizeClasses;
+	std::vector<uint32_t> m_sizeClassBlocks;	// (per m_sizeClasses)
+	std::vector<pool_site_config> m_sites;
+    };
+
+
+    /*
+     * Thread-safe pool of the size classes of a pool_config: a request is
+     * rounded up to the smallest size class fitting it, and served from the
+     * free list of that class, refilled with chunks from the upstream resource.
+     * The chunks of a class double in size, from 4 KiB worth of blocks, up to
+     * its peak live blocks (max_blocks_per_chunk for a configuration without
+     * them), and at most 1 MiB. Requests larger than the largest size
+     * class, or more aligned than the blocks of their class, go to upstream.
+     * Each size class has its own lock, and the chunks are only returned to
+     * upstream by release() (or on destruction).
+     */
+    class SizeClassPoolResource : public std::pmr::memory_resource
+    {
+    public:
+	explicit SizeClassPoolResource(const pool_config& _config,
+				       std::pmr::memory_resource* _upstream=std::pmr::new_delete_resource());
+	~SizeClassPoolResource() override { release(); }
+	SizeClassPoolResource(const SizeClassPoolResource&) = delete;
+	SizeClassPoolResource& operator=(const SizeClassPoolResource&) = delete;
+
+	void release();
+	std::pmr::memory_resource* upstream_resource() const { return m_upstream; }
+
+    protected:
+	void* do_allocate(std::size_t _bytes, std::size_t _alignment) override;
+	void do_deallocate(void* _ptr, std::size_t _bytes, std::size_t _alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override { return this == &_other; }
+
+    private:
+	struct size_class
+	{
+	    size_t m_blockBytes = 0;
+	    size_t m_alignment = 0;	// of every block
+	    size_t m_chunkBlocks = 0;	// of the next chunk
+	    size_t m_maxChunkBlocks = 0;
+	    std::mutex m_mutex;
+	    void* m_free = nullptr;	// singly linked through the first word of a block
+	    std::vector<std::pair<void*, size_t>> m_chunks;	// (address, bytes)
+	};
+	size_class* _find(size_t _bytes, size_t _alignment);
+
+    private:
+	std::vector<std::unique_ptr<size_class>> m_classes;
+	std::pmr::memory_resource* m_upstream;
+    };
+
+
+    /*
+     * A tracked memory resource drawing from a SizeClassPoolResource configured
+     * by a pool_config, e.g.
+     *	    Syn::PoolMemoryResource rsrc(config);
+     *	    Syn::vector<int> v(&rsrc);
+     */
+    class PoolMemoryResource : public MemoryResource
+    {
+    public:
+	// (only the address of m_pool is taken before it's constructed)
+	explicit PoolMemoryResource(const pool_config& _config, AllocType _alloc_type=AllocType::STL) :
+	    MemoryResource(memory_log::insert, memory_log::remove, _alloc_type, &m_pool),
+	    m_pool(_config, std::pmr::new_delete_resource())
+	{}
+
+    private:
+	SizeClassPoolResource m_pool;
+    };
+
+
+} // namespace Syn
+
+
+#endif // __SYN_POOL_CONFIG_H
+
@@ -0,0 +1,474 @@
+
+#include "syn_report_writer.h"
+
+#include <algorithm>
+#include <stdio.h>		// snprintf()
+#include <errno.h>
+
+#ifdef __linux__
+#include <unistd.h>		// write(), close()
+#include <fcntl.h>		// open()
+#elif defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+
+namespace Syn {
+
+    //-----------------------------------------------------------------------------------
+    report_writer::report_writer(size_t _buffer_bytes) :
+	m_buffer(new char[std::max<size_t>(_buffer_bytes, 64)]),
+	m_bufferBytes(std::max<size_t>(_buffer_bytes, 64))
+    {}
+
+
+    //-----------------------------------------------------------------------------------
+    bool report_writer::write(int _fd, bool _omit_deallocated)
+    {
+	/* The names are looked up before taking the record lock, their registries
+	 * have locks of their own.
+	 */
+	m_tagNames.clear();
+	for (uint16_t tag = 0; tag < memory_tag::count(); tag++)
+	    m_tagNames.push_back(memory_tag::name(tag));
+	m_threadNames.clear();
+	for (uint16_t thread = 0; thread < memory_thread::count(); thread++)
+	    m_threadNames.push_back(memory_thread::name(thread));
+	{
+	    std::lock_guard<std::mutex> lock(memory_log::s_mutex);
+	    m_siteNames = memory_log::s_siteNames;
+	    m_siteAllocs.assign(memory_log::s_siteCounts.size(), site_allocs());
+	    for (size_t site = 0; site < m_siteAllocs.size(); site++)
+		for (int type = 0; type < 4; type++)
+		    for (auto& count : { memory_log::s_siteCounts[site].m_own[type], memory_log::s_siteCounts[site].m_inherited[type] })
+		    {
+			m_siteAllocs[site].m_count += count.m_allocs;
+			m_siteAllocs[site].m_bytes += count.m_allocBytes;
+		    }
+	}
+
+	m_fd = _fd;
+	m_used = 0;
+	m_failed = false;
+	begin();
+
+	/* The records are exported in batches of buckets, the buffer only being
+	 * written out with the record lock released, so that a slow or blocked
+	 * _fd does not stall every allocating thread. Records inserted or removed
+	 * between two batches may or may not be exported, and a rehash in between
+	 * may skip or repeat some.
+	 */
+	size_t bucket = 0;
+	while (!m_failed)
+	{
+	    {
+		std::lock_guard<std::mutex> lock(memory_log::s_mutex);
+		m_locked = true;
+		auto& memory = memory_log::s_memory;
+		for (; bucket < memory.bucket_count() && m_used < m_bufferBytes / 2; bucket++)
+		    for (auto it = memory.begin(bucket); it != memory.end(bucket); ++it)
+		    {
+			if (_omit_deallocated && it->second.is_deallocated())
+			    continue;
+			record(it->first, it->second);
+		    }
+		m_locked = false;
+		if (bucket >= memory.bucket_count())
+		    break;
+	    }
+	    flush();
+	}
+	end();
+	flush();
+	m_fd = -1;
+	return !m_failed;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    bool report_writer::write(const std::string& _path, bool _omit_deallocated)
+    {
+#ifdef __linux__
+	int fd = open(_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#elif defined(_WIN32)
+	int fd = _open(_path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#endif
+	if (fd < 0)
+	{
+	    SYN_CORE_WARNING("report_writer: could not open '" << _path << "'.");
+	    return false;
+	}
+	bool ok = write(fd, _omit_deallocated);
+#ifdef __linux__
+	ok = close(fd) == 0 && ok;
+#elif defined(_WIN32)
+	ok = _close(fd) == 0 && ok;
+#endif
+	return ok;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void report_writer::put(const char* _str, size_t _len)
+    {
+	while (_len > 0)
+	{
+	    if (m_used == m_bufferBytes)
+	    {
+		// (never written out under the record lock)
+		if (m_locked)
+		{
+		    m_spill.append(_str, _len);
+		    return;
+		}
+		flush();
+	    }
+	    size_t n = std::min(_len, m_bufferBytes - m_used);
+	    memcpy(m_buffer.get() + m_used, _str, n);
+	    m_used += n;
+	    _str += n;
+	    _len -= n;
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void report_writer::put_uint(uint64_t _value)
+    {
+	char buf[24];
+	int n = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)_value);
+	put(buf, (size_t)n);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void report_writer::put_addr(const void* _mem_addr)
+    {
+	char buf[24];
+	int n = snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)(uintptr_t)_mem_addr);
+	put(buf, (size_t)n);
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    bool report_writer::flush()
+    {
+	// after a failed write, the rest of the export is dropped
+	_write_all(m_buffer.get(), m_used);
+	m_used = 0;
+	_write_all(m_spill.data(), m_spill.size());
+	m_spill.clear();
+	return !m_failed;
+    }
+
+    void report_writer::_write_all(const char* _data, size_t _len)
+    {
+	while (_len > 0 && !m_failed)
+	{
+#ifdef __linux__
+	    ssize_t n = ::write(m_fd, _data, _len);
+#elif defined(_WIN32)
+	    int n = _write(m_fd, _data, (unsigned)_len);
+#endif
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+	    {
+		SYN_CORE_WARNING("report_writer: write to fd " << m_fd << " failed.");
+		m_failed = true;
+		break;
+	    }
+	    _data += n;
+	    _len -= (size_t)n;
+	}
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    const std::string& report_writer::tag_name(uint16_t _tag) const
+    {
+	static const std::string unknown;
+	return _tag < m_tagNames.size() ? m_tagNames[_tag] : unknown;
+    }
+
+    const std::string& report_writer::thread_name(uint16_t _thread) const
+    {
+	static const std::string unknown;
+	return _thread < m_threadNames.size() ? m_threadNames[_thread] : unknown;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void json_lines_writer::record(const void* _mem_addr, const memory_alloc_info& _info)
+    {
+	put("{\"address\":\"");
+	put_addr(_mem_addr);
+	put("\",\"type\":");
+	put_string(AllocTypeStr(_info.m_allocType));
+	put(",\"alloc_bytes\":");
+	put_uint(_info.m_allocBytes);
+	put(",\"alloc_block\":");
+	put_uint(_info.m_allocBlock);
+	put(",\"dealloc_bytes\":");
+	put_uint(_info.m_deallocBytes);
+	put(",\"dealloc_block\":");
+	put_uint(_info.m_deallocBlock);
+	put(",\"live\":");
+	put(_info.is_deallocated() ? "false" : "true");
+	put(",\"inherited\":");
+	put(_info.m_inherited ? "true" : "false");
+	put(",\"tag\":");
+	put_string(tag_name(_info.m_tag));
+	put(",\"alloc_thread\":");
+	put_string(thread_name(_info.m_allocThread));
+	put(",\"dealloc_thread\":");
+	put_string(thread_name(_info.m_deallocThread));
+	put(",\"caller\":");
+	put_string(_info.m_callerFnc);
+	put("}\n");
+    }
+
+    void json_lines_writer::put_string(const std::string& _str)
+    {
+	put('"');
+	for (char c : _str)
+	{
+	    if (c == '"' || c == '\\')
+	    {
+		put('\\');
+		put(c);
+	    }
+	    else if ((unsigned char)c < 0x20)
+	    {
+		char buf[8];
+		snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+		put(buf, 6);
+	    }
+	    else
+		put(c);
+	}
+	put('"');
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void csv_writer::begin()
+    {
+	put("address,type,alloc_bytes,alloc_block,dealloc_bytes,dealloc_block,live,inherited,tag,alloc_thread,dealloc_thread,caller\n");
+    }
+
+    void csv_writer::record(const void* _mem_addr, const memory_alloc_info& _info)
+    {
+	put_addr(_mem_addr);
+	put(',');
+	put(AllocTypeStr(_info.m_allocType));
+	put(',');
+	put_uint(_info.m_allocBytes);
+	put(',');
+	put_uint(_info.m_allocBlock);
+	put(',');
+	put_uint(_info.m_deallocBytes);
+	put(',');
+	put_uint(_info.m_deallocBlock);
+	put(_info.is_deallocated() ? ",0," : ",1,");
+	put(_info.m_inherited ? "1," : "0,");
+	put_string(tag_name(_info.m_tag));
+	put(',');
+	put_string(thread_name(_info.m_allocThread));
+	put(',');
+	put_string(thread_name(_info.m_deallocThread));
+	put(',');
+	put_string(_info.m_callerFnc);
+	put('\n');
+    }
+
+    // (RFC 4180: quoted if needed, with quotes doubled)
+    void csv_writer::put_string(const std::string& _str)
+    {
+	if (_str.find_first_of(",\"\r\n") == std::string::npos)
+	{
+	    put(_str);
+	    return;
+	}
+	put('"');
+	for (char c : _str)
+	{
+	    if (c == '"')
+		put('"');
+	    put(c);
+	}
+	put('"');
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    /* Minimal protocol buffers encoding (varint and length-delimited fields),
+     * and gzip framing with stored (uncompressed) deflate blocks, so that the
+     * pprof profile needs no protobuf or zlib.
+     */
+    static void pb_varint(std::string& _out, uint64_t _value)
+    {
+	while (_value >= 0x80)
+	{
+	    _out.push_back((char)(_value | 0x80));
+	    _value >>= 7;
+	}
+	_out.push_back((char)_value);
+    }
+
+    static void pb_uint(std::string& _out, uint32_t _field, uint64_t _value)
+    {
+	pb_varint(_out, (uint64_t)_field << 3);
+	pb_varint(_out, _value);
+    }
+
+    static void pb_bytes(std::string& _out, uint32_t _field, const std::string& _bytes)
+    {
+	pb_varint(_out, ((uint64_t)_field << 3) | 2);
+	pb_varint(_out, _bytes.size());
+	_out += _bytes;
+    }
+
+    static uint32_t crc32(const std::string& _data)
+    {
+	static uint32_t table[256];
+	static bool init = false;
+	if (!init)
+	{
+	    for (uint32_t i = 0; i < 256; i++)
+	    {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+		    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	    }
+	    init = true;
+	}
+	uint32_t crc = 0xffffffffu;
+	for (char c : _data)
+	    crc = table[(crc ^ (uint8_t)c) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffu;
+    }
+
+    static std::string gzip_stored(const std::string& _data)
+    {
+	static const char header[10] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+	std::string out(header, sizeof(header));
+	size_t pos = 0;
+	do
+	{
+	    size_t len = std::min<size_t>(_data.size() - pos, 65535);
+	    bool last = pos + len == _data.size();
+	    out.push_back(last ? 1 : 0);
+	    out.push_back((char)(len & 0xff));
+	    out.push_back((char)(len >> 8));
+	    out.push_back((char)(~len & 0xff));
+	    out.push_back((char)((~len >> 8) & 0xff));
+	    out.append(_data, pos, len);
+	    pos += len;
+	} while (pos < _data.size());
+	uint32_t trailer[2] = { crc32(_data), (uint32_t)_data.size() };
+	for (uint32_t word : trailer)
+	    for (int shift = 0; shift < 32; shift += 8)
+		out.push_back((char)((word >> shift) & 0xff));
+	return out;
+    }
+
+
+    //-----------------------------------------------------------------------------------
+    void pprof_writer::record(const void*, const memory_alloc_info& _info)
+    {
+	if (_info.is_deallocated())
+	    return;
+	if (_info.m_site >= m_inuse.size())
+	    m_inuse.resize(_info.m_site + 1);
+	m_inuse[_info.m_site].m_count++;
+	m_inuse[_info.m_site].m_bytes += _info.m_allocBytes;
+    }
+
+    void pprof_writer::end()
+    {
+	// (field numbers of perftools.profiles.Profile, profile.proto)
+	std::string profile;
+	std::vector<std::string> strings = { "" };
+	std::unordered_map<std::string, uint64_t> string_ids = { { "", 0 } };
+	auto string_id = [&](const std::string& _str)
+	{
+	    auto it = string_ids.insert({ _str, strings.size() });
+	    if (it.second)
+		strings.push_back(_str);
+	    return it.first->second;
+	};
+
+	// (in the order of the sample values)
+	static const char* sample_types[4][2] = { { "alloc_objects", "count" }, { "alloc_space", "bytes" },
+						  { "inuse_objects", "count" }, { "inuse_space", "bytes" } };
+	for (auto& type : sample_types)
+	{
+	    std::string value_type;
+	    pb_uint(value_type, 1, string_id(type[0]));
+	    pb_uint(value_type, 2, string_id(type[1]));
+	    pb_bytes(profile, 1, value_type);
+	}
+
+	// call site i is function and location i + 1
+	for (uint32_t site = 0; site < site_count(); site++)
+	{
+	    site_allocs inuse = site < m_inuse.size() ? m_inuse[site] : site_allocs();
+	    const site_allocs& alloc = site_allocations(site);
+	    if (alloc.m_count == 0 && inuse.m_count == 0)
+		continue;
+	    uint64_t id = site + 1;
+
+	    // "<file>:<line>: <function>  <type>", see get_caller_signature()
+	    const std::string& caller = site_name(site);
+	    std::string name = caller.empty() ? "(no caller function specified)" : caller;
+	    std::string file;
+	    uint64_t line = 0;
+	    size_t colon = caller.find(':');
+	    size_t end = caller.find(": ", colon == std::string::npos ? 0 : colon + 1);
+	    if (colon != std::string::npos && end != std::string::npos)
+	    {
+		file = caller.substr(0, colon);
+		line = strtoull(caller.c_str() + colon + 1, nullptr, 10);
+	    }
+
+	    std::string function;
+	    pb_uint(function, 1, id);
+	    pb_uint(function, 2, string_id(name));
+	    pb_uint(function, 3, string_id(name));
+	    pb_uint(function, 4, string_id(file));
+	    pb_bytes(profile, 5, function);
+
+	    std::string location, location_line;
+	    pb_uint(location_line, 1, id);
+	    pb_uint(location_line, 2, line);
+	    pb_uint(location, 1, id);
+	    pb_bytes(location, 4, location_line);
+	    pb_bytes(profile, 4, location);
+
+	    std::string sample, values;
+	    pb_uint(sample, 1, id);
+	    pb_varint(values, alloc.m_count);
+	    pb_varint(values, alloc.m_bytes);
+	    pb_varint(values, inuse.m_count);
+	    pb_varint(values, inuse.m_bytes);
+	    pb_bytes(sample, 2, values);
+	    pb_bytes(profile, 2, sample);
+	}
+
+	std::string period_type;
+	pb_uint(period_type, 1, string_id("space"));
+	pb_uint(period_type, 2, string_id("bytes"));
+	pb_bytes(profile, 11, period_type);
+	pb_uint(profile, 12, 1);
+	for (auto& str : strings)
+	    pb_bytes(profile, 6, str);
+
+	put(gzip_stored(profile));
+	m_inuse.clear();
+    }
+
+
+}
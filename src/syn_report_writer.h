@@ -0,0 +1,135 @@
+#ifndef __SYN_REPORT_WRITER_H
+#define __SYN_REPORT_WRITER_H
+
+#include "syn_allocator.h"
+
+
+namespace Syn {
+
+    /*
+     * Machine-readable export of the memory_log records, streamed to a file
+     * descriptor through a fixed buffer (reused across exports), so that the
+     * extra memory of a dump does not grow with the number of records, e.g.
+     *	    Syn::json_lines_writer writer;
+     *	    writer.write("memory.jsonl");
+     * A format is a report_writer implementing record(), and optionally begin()
+     * and end(). record() is called with the record lock held (so it must not
+     * make tracked allocations), begin() and end() without it.
+     */
+    class report_writer
+    {
+    public:
+	explicit report_writer(size_t _buffer_bytes=64*1024);
+	virtual ~report_writer() {}
+
+	// Export the records (only the live ones if _omit_deallocated) to _fd or to _path.
+	// The record lock is taken for a batch of records at a time, and released
+	// while writing to _fd, but a pipe or socket nobody reads still blocks the
+	// calling thread.
+	bool write(int _fd, bool _omit_deallocated=true);
+	bool write(const std::string& _path, bool _omit_deallocated=true);
+
+    protected:
+	virtual void begin() {}
+	virtual void record(const void* _mem_addr, const memory_alloc_info& _info) = 0;
+	virtual void end() {}
+
+	// buffered output
+	void put(const char* _str, size_t _len);
+	void put(const char* _str) { put(_str, strlen(_str)); }
+	void put(const std::string& _str) { put(_str.data(), _str.size()); }
+	void put(char _c) { if (m_used == m_bufferBytes) put(&_c, 1); else m_buffer[m_used++] = _c; }
+	void put_uint(uint64_t _value);
+	void put_addr(const void* _mem_addr);
+	bool flush();
+
+	// names of tags and threads ("" if unknown), as of the start of the export
+	const std::string& tag_name(uint16_t _tag) const;
+	const std::string& thread_name(uint16_t _thread) const;
+
+	// call sites (memory_alloc_info::m_site) with their number and bytes of all
+	// allocations, as of the start of the export
+	struct site_allocs { uint64_t m_count = 0; uint64_t m_bytes = 0; };
+	uint32_t site_count() const { return (uint32_t)m_siteNames.size(); }
+	const std::string& site_name(uint32_t _site) const { return m_siteNames[_site]; }
+	const site_allocs& site_allocations(uint32_t _site) const { return m_siteAllocs[_site]; }
+
+    private:
+	void _write_all(const char* _data, size_t _len);
+
+    private:
+	std::unique_ptr<char[]> m_buffer;
+	size_t m_bufferBytes;
+	size_t m_used = 0;
+	// output past a full buffer while the record lock is held
+	std::string m_spill;
+	bool m_locked = false;
+	int m_fd = -1;
+	bool m_failed = false;
+	std::vector<std::string> m_tagNames;
+	std::vector<std::string> m_threadNames;
+	std::vector<std::string> m_siteNames;
+	std::vector<site_allocs> m_siteAllocs;
+    };
+
+
+    // One JSON object per record and line.
+    class json_lines_writer : public report_writer
+    {
+    public:
+	using report_writer::report_writer;
+
+    protected:
+	void record(const void* _mem_addr, const memory_alloc_info& _info) override;
+
+    private:
+	void put_string(const std::string& _str);
+    };
+
+
+    // Comma-separated values, one record per row, after a header row.
+    class csv_writer : public report_writer
+    {
+    public:
+	using report_writer::report_writer;
+
+    protected:
+	void begin() override;
+	void record(const void* _mem_addr, const memory_alloc_info& _info) override;
+
+    private:
+	void put_string(const std::string& _str);
+    };
+
+
+    /*
+     * Heap profile in the pprof format (gzipped profile.proto): one sample per
+     * call site, whose location is a function named after the call site (with
+     * its file and line), with the objects and bytes of all its allocations
+     * (alloc_objects, alloc_space, from the call site counters) and of its live
+     * ones (inuse_objects, inuse_space, from the live records), e.g.
+     *	    go tool pprof -top memory.pb.gz
+     * The live records are aggregated per call site, which is the extra memory
+     * it takes, the profile is built in memory and written out by end().
+     */
+    class pprof_writer : public report_writer
+    {
+    public:
+	using report_writer::report_writer;
+
+    protected:
+	void begin() override { m_inuse.clear(); }
+	void record(const void* _mem_addr, const memory_alloc_info& _info) override;
+	void end() override;
+
+    private:
+	// per call site id
+	std::vector<site_allocs> m_inuse;
+    };
+
+
+} // namespace Syn
+
+
+#endif // __SYN_REPORT_WRITER_H
+
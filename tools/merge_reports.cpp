@@ -0,0 +1,220 @@
+
+/*
+ * Merges the per call site profiles written by Syn::memory_log::write_report()
+ * (<prefix>.<pid>.tsv) of N worker processes into one fleet-level view.
+ *
+ * Allocations made by each worker are summed over the workers. Allocations 
+ * inherited from the parent at fork() are shared (copy-on-write) between the
+ * workers, and are counted once, as the largest live size seen in any worker.
+ *
+ *	merge_reports [-o merged.tsv] report.1234.tsv report.1235.tsv ...
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>		// strtoull()
+#include <errno.h>
+
+
+struct site_profile
+{
+    uint32_t m_workers = 0;
+    uint64_t m_allocs = 0, m_frees = 0;
+    uint64_t m_allocBytes = 0, m_allocBlock = 0;
+    uint64_t m_liveBytes = 0, m_liveBlock = 0;
+
+    void merge(const site_profile& _other, bool _inherited)
+    {
+	m_workers++;
+	if (_inherited)
+	{
+	    // the same allocations in every worker: keep the largest
+	    m_allocs     = std::max(m_allocs,     _other.m_allocs);
+	    m_frees      = std::max(m_frees,      _other.m_frees);
+	    m_allocBytes = std::max(m_allocBytes, _other.m_allocBytes);
+	    m_allocBlock = std::max(m_allocBlock, _other.m_allocBlock);
+	    m_liveBytes  = std::max(m_liveBytes,  _other.m_liveBytes);
+	    m_liveBlock  = std::max(m_liveBlock,  _other.m_liveBlock);
+	    return;
+	}
+	m_allocs     += _other.m_allocs;
+	m_frees      += _other.m_frees;
+	m_allocBytes += _other.m_allocBytes;
+	m_allocBlock += _other.m_allocBlock;
+	m_liveBytes  += _other.m_liveBytes;
+	m_liveBlock  += _other.m_liveBlock;
+    }
+};
+
+// (type, caller) -> profile, for own and inherited allocations
+typedef std::map<std::pair<std::string, std::string>, site_profile> site_map;
+
+
+//---------------------------------------------------------------------------------------
+static bool parse_count(const std::string& _col, uint64_t& _value)
+{
+    // digits only: strtoull() would accept a sign, and leading white space
+    if (_col.empty() || _col[0] < '0' || _col[0] > '9')
+	return false;
+    char* end = nullptr;
+    errno = 0;
+    _value = strtoull(_col.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+
+//---------------------------------------------------------------------------------------
+static bool read_profile(const std::string& _path, site_map& _own, site_map& _inherited)
+{
+    std::ifstream in(_path);
+    if (!in)
+    {
+	std::cerr << "merge_reports: could not open '" << _path << "'.\n";
+	return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+	if (line.empty() || line[0] == '#')
+	    continue;
+	std::vector<std::string> cols;
+	std::istringstream ss(line);
+	std::string col;
+	while (std::getline(ss, col, '\t'))
+	    cols.push_back(col);
+	site_profile p;
+	if (cols.size() != 9 ||
+	    !parse_count(cols[3], p.m_allocs) ||
+	    !parse_count(cols[4], p.m_frees) ||
+	    !parse_count(cols[5], p.m_allocBytes) ||
+	    !parse_count(cols[6], p.m_allocBlock) ||
+	    !parse_count(cols[7], p.m_liveBytes) ||
+	    !parse_count(cols[8], p.m_liveBlock))
+	{
+	    std::cerr << "merge_reports: malformed line in '" << _path << "': " << line << "\n";
+	    continue;
+	}
+	bool inherited = cols[2] == "1";
+	site_map& sites = inherited ? _inherited : _own;
+	sites[{ cols[0], cols[1] }].merge(p, inherited);
+    }
+    return true;
+}
+
+
+//---------------------------------------------------------------------------------------
+static std::string fmt_sz(uint64_t _bytes)
+{
+    static constexpr uint64_t mb = 1024 * 1024;
+    std::ostringstream ss;
+    if (_bytes <= 1024)	       ss << _bytes << " B";
+    else if (_bytes < mb)      ss << std::fixed << std::setprecision(2) << (double)_bytes / 1024.0 << " K";
+    else if (_bytes < 1024*mb) ss << std::fixed << std::setprecision(2) << (double)_bytes / (double)mb << " M";
+    else		       ss << std::fixed << std::setprecision(2) << (double)_bytes / ((double)mb * 1024.0) << " G";
+    return ss.str();
+}
+
+
+//---------------------------------------------------------------------------------------
+static void print_sites(const site_map& _sites, const char* _title)
+{
+    if (_sites.empty())
+	return;
+
+    // from largest to smallest live size
+    std::vector<site_map::const_iterator> ranked;
+    for (auto it = _sites.begin(); it != _sites.end(); ++it)
+	ranked.push_back(it);
+    std::sort(ranked.begin(), ranked.end(), 
+	      [](site_map::const_iterator _a, site_map::const_iterator _b) { return _a->second.m_liveBytes > _b->second.m_liveBytes; });
+
+    std::cout << std::setw(24) << std::left << _title;
+    std::cout << std::setw(70) << std::right << "CALLING FUNCTION";
+    std::cout << std::setw(9) << std::right << "WORKERS";
+    std::cout << std::setw(10) << std::right << "ALLOCS";
+    std::cout << std::setw(10) << std::right << "FREES";
+    std::cout << std::setw(26) << std::right << "ALLOC (BLOCK)";
+    std::cout << std::setw(26) << std::right << "LIVE (BLOCK)" << "\n";
+    site_profile total;
+    for (auto it : ranked)
+    {
+	const site_profile& p = it->second;
+	std::cout << std::setw(4) << "" << std::setw(20) << std::left << it->first.first;
+	std::cout << std::setw(70) << std::right << it->first.second;
+	std::cout << std::setw(9) << std::right << p.m_workers;
+	std::cout << std::setw(10) << std::right << p.m_allocs;
+	std::cout << std::setw(10) << std::right << p.m_frees;
+	std::cout << std::setw(12) << std::right << fmt_sz(p.m_allocBytes) << std::setw(14) << std::right << " (" + fmt_sz(p.m_allocBlock) + ")";
+	std::cout << std::setw(12) << std::right << fmt_sz(p.m_liveBytes) << std::setw(14) << std::right << " (" + fmt_sz(p.m_liveBlock) + ")" << "\n";
+	total.merge(p, false);
+    }
+    std::cout << "Allocated:   " << std::right << std::setw(12) << fmt_sz(total.m_allocBytes) << std::right << std::setw(14) << " (" + fmt_sz(total.m_allocBlock) + ")" << "\n";
+    std::cout << "Live:        " << std::right << std::setw(12) << fmt_sz(total.m_liveBytes) << std::right << std::setw(14) << " (" + fmt_sz(total.m_liveBlock) + ")" << "\n\n";
+}
+
+
+//---------------------------------------------------------------------------------------
+static void write_sites(std::ofstream& _out, const site_map& _sites, bool _inherited)
+{
+    for (auto& it : _sites)
+    {
+	const site_profile& p = it.second;
+	_out << it.first.first << '\t' << it.first.second << '\t' << _inherited << '\t';
+	_out << p.m_allocs << '\t' << p.m_frees << '\t' << p.m_allocBytes << '\t' << p.m_allocBlock << '\t';
+	_out << p.m_liveBytes << '\t' << p.m_liveBlock << '\n';
+    }
+}
+
+
+//---------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    std::string out_path;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+	std::string arg = argv[i];
+	if (arg == "-o" && i + 1 < argc)
+	    out_path = argv[++i];
+	else
+	    paths.push_back(arg);
+    }
+    if (paths.empty())
+    {
+	std::cerr << "usage: merge_reports [-o merged.tsv] <prefix>.<pid>.tsv ...\n";
+	return 1;
+    }
+
+    site_map own, inherited;
+    size_t workers = 0;
+    for (auto& path : paths)
+	workers += read_profile(path, own, inherited);
+
+    std::cout << "FLEET MEMORY REPORT (" << workers << " processes)\n";
+    print_sites(own, "ALLOCATED BY WORKERS");
+    print_sites(inherited, "INHERITED (ONCE)");
+
+    // the merged profile has the same format, and can be merged again
+    if (!out_path.empty())
+    {
+	std::ofstream out(out_path);
+	if (!out)
+	{
+	    std::cerr << "merge_reports: could not write '" << out_path << "'.\n";
+	    return 1;
+	}
+	out << "# merged from " << workers << " processes\n";
+	out << "# type\tcaller\tinherited\tallocs\tfrees\talloc_bytes\talloc_block\tlive_bytes\tlive_block\n";
+	write_sites(out, own, false);
+	write_sites(out, inherited, true);
+    }
+    return 0;
+}
+
@@ -0,0 +1,335 @@
+
+/*
+ * Replays an allocation trace recorded by Syn::memory_log::start_trace() against
+ * a number of allocators, reporting the wall time, the peak RSS growth and the
+ * slack (peak RSS growth beyond the peak of live requested bytes) of each.
+ *
+ * Every recorded thread is replayed by a thread of its own, in its recorded
+ * order. A deallocation of memory allocated by another thread waits for that
+ * allocation, so cross-thread frees stay cross-thread. Each allocator is run in
+ * a forked child, to keep the RSS measurements apart.
+ *
+ *	replay_trace <trace> [backend ...]
+ *
+ * Allocators are std::pmr::memory_resource:s, added to replay_backends() below.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+struct trace_event
+{
+    bool m_alloc;
+    uint32_t m_object;	// index of the allocated object
+    uint32_t m_bytes;
+};
+
+struct trace
+{
+    std::vector<std::vector<trace_event>> m_threads;	// events per thread
+    std::vector<uint16_t> m_allocThread;		// allocating thread per object
+    std::vector<uint32_t> m_bytes;			// bytes per object
+    uint64_t m_events = 0;
+    uint64_t m_peakLive = 0;				// peak of live requested bytes
+};
+
+
+/*
+ * Allocators to replay against: a name, whether it may be used from several
+ * threads, and a factory for a fresh instance.
+ */
+struct replay_backend
+{
+    std::string m_name;
+    bool m_threadSafe;
+    std::function<std::unique_ptr<std::pmr::memory_resource>()> m_create;
+};
+
+
+// glibc malloc()/free(), as a memory_resource
+class malloc_resource : public std::pmr::memory_resource
+{
+    void* do_allocate(std::size_t _bytes, std::size_t _alignment) override
+    {
+	void* ptr = _alignment <= alignof(std::max_align_t) ? malloc(_bytes) : aligned_alloc(_alignment, (_bytes + _alignment - 1) & ~(_alignment - 1));
+	if (ptr == nullptr)
+	    throw std::bad_alloc{};
+	return ptr;
+    }
+    void do_deallocate(void* _ptr, std::size_t, std::size_t) override { free(_ptr); }
+    bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override { return this == &_other; }
+};
+
+// a memory_resource that does not own its upstream
+class upstream_resource : public std::pmr::memory_resource
+{
+public:
+    explicit upstream_resource(std::pmr::memory_resource* _upstream) : m_upstream(_upstream) {}
+private:
+    void* do_allocate(std::size_t _bytes, std::size_t _alignment) override { return m_upstream->allocate(_bytes, _alignment); }
+    void do_deallocate(void* _ptr, std::size_t _bytes, std::size_t _alignment) override { m_upstream->deallocate(_ptr, _bytes, _alignment); }
+    bool do_is_equal(const std::pmr::memory_resource& _other) const noexcept override { return this == &_other; }
+    std::pmr::memory_resource* m_upstream;
+};
+
+static std::vector<replay_backend> replay_backends()
+{
+    return {
+	{ "malloc", true, []() { return std::make_unique<malloc_resource>(); } },
+	{ "new_delete", true, []() { return std::make_unique<upstream_resource>(std::pmr::new_delete_resource()); } },
+	{ "synchronized_pool", true, []() { return std::make_unique<std::pmr::synchronized_pool_resource>(); } },
+	{ "unsynchronized_pool", false, []() { return std::make_unique<std::pmr::unsynchronized_pool_resource>(); } },
+	{ "monotonic", false, []() { return std::make_unique<std::pmr::monotonic_buffer_resource>(); } },
+    };
+}
+
+
+//---------------------------------------------------------------------------------------
+static bool load_trace(const std::string& _path, trace& _trace)
+{
+    std::ifstream in(_path);
+    if (!in)
+    {
+	std::cerr << "replay_trace: could not open '" << _path << "'.\n";
+	return false;
+    }
+    // thread ids of the trace -> replay threads, live addresses -> objects
+    std::unordered_map<unsigned, uint16_t> threads;
+    std::unordered_map<std::string, uint32_t> live;
+    uint64_t live_bytes = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+	// (call site definitions are not needed for replay)
+	if (line.empty() || line[0] == '#' || line[0] == 's')
+	    continue;
+	std::istringstream ss(line);
+	char op;
+	unsigned tid;
+	std::string addr;
+	uint32_t bytes = 0;
+	if (!(ss >> op >> tid >> addr) || (op == 'a' && !(ss >> bytes)))
+	{
+	    std::cerr << "replay_trace: malformed line: " << line << "\n";
+	    continue;
+	}
+	auto t = threads.find(tid);
+	if (t == threads.end())
+	{
+	    t = threads.insert({ tid, (uint16_t)_trace.m_threads.size() }).first;
+	    _trace.m_threads.emplace_back();
+	}
+	uint16_t thread = t->second;
+
+	if (op == 'a')
+	{
+	    // an address reused without a recorded free is left allocated
+	    uint32_t object = (uint32_t)_trace.m_bytes.size();
+	    _trace.m_bytes.push_back(bytes);
+	    _trace.m_allocThread.push_back(thread);
+	    live[addr] = object;
+	    live_bytes += bytes;
+	    _trace.m_peakLive = std::max(_trace.m_peakLive, live_bytes);
+	    _trace.m_threads[thread].push_back({ true, object, bytes });
+	}
+	else
+	{
+	    // frees of memory allocated before the trace started are skipped
+	    auto it = live.find(addr);
+	    if (it == live.end())
+		continue;
+	    uint32_t object = it->second;
+	    live.erase(it);
+	    live_bytes -= _trace.m_bytes[object];
+	    _trace.m_threads[thread].push_back({ false, object, _trace.m_bytes[object] });
+	}
+	_trace.m_events++;
+    }
+    return true;
+}
+
+
+//---------------------------------------------------------------------------------------
+static uint64_t current_rss()
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t vm_pages = 0, rss_pages = 0;
+    statm >> vm_pages >> rss_pages;
+    return rss_pages * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+
+//---------------------------------------------------------------------------------------
+struct replay_result
+{
+    double m_seconds = 0.0;
+    uint64_t m_peakRss = 0;	// growth over the RSS before the replay
+};
+
+static replay_result replay(const trace& _trace, std::pmr::memory_resource* _rsrc)
+{
+    std::vector<std::atomic<void*>> objects(_trace.m_bytes.size());
+    for (auto& o : objects)
+	o.store(nullptr, std::memory_order_relaxed);
+
+    /* The monitor and replay threads park on go, so that the baseline is taken
+     * with their stacks already mapped, and only the resource's memory counts.
+     */
+    std::atomic<bool> go(false);
+    std::atomic<size_t> parked(0);
+    std::atomic<uint64_t> peak(0);
+    std::atomic<bool> done(false);
+    std::thread monitor([&]()
+    {
+	parked++;
+	while (!go.load()) std::this_thread::yield();
+	while (!done.load())
+	{
+	    uint64_t rss = current_rss();
+	    if (rss > peak.load()) peak.store(rss);
+	    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+    });
+
+    std::vector<std::thread> threads;
+    for (auto& events : _trace.m_threads)
+    {
+	threads.emplace_back([&]()
+	{
+	    parked++;
+	    while (!go.load()) std::this_thread::yield();
+	    for (const trace_event& e : events)
+	    {
+		if (e.m_alloc)
+		{
+		    objects[e.m_object].store(_rsrc->allocate(e.m_bytes), std::memory_order_release);
+		    continue;
+		}
+		// wait for an allocation made by another thread
+		void* ptr;
+		while ((ptr = objects[e.m_object].load(std::memory_order_acquire)) == nullptr)
+		    std::this_thread::yield();
+		_rsrc->deallocate(ptr, e.m_bytes);
+	    }
+	});
+    }
+
+    while (parked.load() < threads.size() + 1)
+	std::this_thread::yield();
+    uint64_t baseline = current_rss();
+    peak.store(baseline);
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto& t : threads)
+	t.join();
+    auto end = std::chrono::steady_clock::now();
+    uint64_t rss = current_rss();
+    if (rss > peak.load()) peak.store(rss);
+    done.store(true);
+    monitor.join();
+
+    replay_result result;
+    result.m_seconds = std::chrono::duration<double>(end - start).count();
+    result.m_peakRss = peak.load() - baseline;
+    return result;
+}
+
+
+//---------------------------------------------------------------------------------------
+static std::string fmt_sz(uint64_t _bytes)
+{
+    static constexpr uint64_t mb = 1024 * 1024;
+    std::ostringstream ss;
+    if (_bytes <= 1024)	       ss << _bytes << " B";
+    else if (_bytes < mb)      ss << std::fixed << std::setprecision(2) << (double)_bytes / 1024.0 << " K";
+    else if (_bytes < 1024*mb) ss << std::fixed << std::setprecision(2) << (double)_bytes / (double)mb << " M";
+    else		       ss << std::fixed << std::setprecision(2) << (double)_bytes / ((double)mb * 1024.0) << " G";
+    return ss.str();
+}
+
+
+//---------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+	std::cerr << "usage: replay_trace <trace> [backend ...]\n";
+	return 1;
+    }
+    trace tr;
+    if (!load_trace(argv[1], tr))
+	return 1;
+    std::vector<std::string> selected(argv + 2, argv + argc);
+
+    std::cout << "REPLAY " << argv[1] << ": " << tr.m_events << " events, " << tr.m_threads.size() << " threads, ";
+    std::cout << "peak live " << fmt_sz(tr.m_peakLive) << "\n";
+    std::cout << std::setw(24) << std::left << "BACKEND";
+    std::cout << std::setw(14) << std::right << "TIME (ms)";
+    std::cout << std::setw(14) << std::right << "PEAK RSS";
+    std::cout << std::setw(14) << std::right << "SLACK" << "\n";
+
+    for (auto& backend : replay_backends())
+    {
+	if (!selected.empty() && std::find(selected.begin(), selected.end(), backend.m_name) == selected.end())
+	    continue;
+	std::cout << std::setw(4) << "" << std::setw(20) << std::left << backend.m_name;
+	if (!backend.m_threadSafe && tr.m_threads.size() > 1)
+	{
+	    std::cout << std::setw(42) << std::right << "(skipped, not thread-safe)" << std::endl;
+	    continue;
+	}
+
+	// replay in a child of its own, reporting back through a pipe
+	int fd[2];
+	if (pipe(fd) != 0)
+	    return 1;
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+	    close(fd[0]);
+	    replay_result result;
+	    {
+		std::unique_ptr<std::pmr::memory_resource> rsrc = backend.m_create();
+		result = replay(tr, rsrc.get());
+	    }
+	    ssize_t n = write(fd[1], &result, sizeof(result));
+	    _exit(n == (ssize_t)sizeof(result) ? 0 : 1);
+	}
+	close(fd[1]);
+	replay_result result;
+	bool ok = read(fd[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+	close(fd[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	if (!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+	    std::cout << std::setw(42) << std::right << "(failed)" << std::endl;
+	    continue;
+	}
+	uint64_t slack = result.m_peakRss > tr.m_peakLive ? result.m_peakRss - tr.m_peakLive : 0;
+	std::cout << std::setw(14) << std::right << std::fixed << std::setprecision(3) << result.m_seconds * 1000.0;
+	std::cout << std::setw(14) << std::right << fmt_sz(result.m_peakRss);
+	std::cout << std::setw(14) << std::right << fmt_sz(slack) << std::endl;
+    }
+    return 0;
+}
+